@@ -0,0 +1,507 @@
+//
+// Static disassembler and control-flow analyser for ROMs
+//
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "cpu.h"
+#include "disasm.h"
+#include "rom.h"
+
+// What the trace found out about each address
+enum {
+  ADDR_SEEN = 1 << 0,    // Reached by the trace
+  ADDR_CODE = 1 << 1,    // Start of an instruction
+  ADDR_LEADER = 1 << 2,  // Starts a basic block
+  ADDR_LABEL = 1 << 3,   // Jumped or called to
+};
+
+// Ways control gets from one block to another
+enum edge_kind {
+  EDGE_NEXT,
+  EDGE_SKIP,
+  EDGE_JUMP,
+  EDGE_CALL,
+  EDGE_TABLE,
+};
+
+struct edge {
+  uint32_t to;
+  uint8_t kind;
+};
+
+// A jump table behind Bnnn has at most this many JPs in it, one for every
+// even value of V0
+#define TABLE_MAX 128
+
+static const char *const isa_names[] = { "CHIP-8", "SUPER-CHIP", "XO-CHIP" };
+
+// Everything worked out about a single ROM
+struct analysis {
+  const char *name;
+  uint32_t size;
+  uint32_t end;
+
+  uint8_t memory[MEMORY_SIZE];
+  uint8_t marks[MEMORY_SIZE];
+
+  // Instructions reached, by mnemonic
+  uint32_t *counts;
+  uint32_t instructions;
+  uint32_t code_bytes;
+
+  // Paths that ran into something that isn't an instruction, or left the ROM
+  uint32_t unknown;
+  uint32_t outside;
+
+  uint8_t isa;
+  uint8_t quirks;
+};
+
+// Totals across every ROM analysed
+struct totals {
+  uint32_t roms;
+  uint64_t bytes;
+  uint64_t code_bytes;
+  uint32_t isa[3];
+  uint32_t quirks[QUIRK_COUNT];
+  uint64_t *counts;
+  uint32_t *roms_using;
+};
+
+// Usage instructions for the analyser
+int print_usage() {
+  printf(
+"Usage: dip-disasm [-l] [-g] [-s] [-p path_to_pack] [path_to_rom...]\n\n"
+"  -l                     List code and data (the default)\n"
+"  -g                     Write the control-flow graph in DOT\n"
+"  -s                     Summarise the instruction mix and quirks used\n"
+"  -p [path_to_pack]      Analyse every ROM in a ROM pack\n\n"
+"  With more than one ROM -s ends with totals across all of them\n");
+
+  exit(EXIT_SUCCESS);
+}
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static uint16_t fetch(const struct analysis *a, uint32_t addr) {
+  return a->memory[addr & MEMORY_MASK] << 8 | a->memory[(addr + 1) & MEMORY_MASK];
+}
+
+static int in_rom(const struct analysis *a, uint32_t addr) {
+  return addr >= ROM_START && addr < a->end;
+}
+
+// Where control can go after the instruction at addr
+// Fills in out, which needs room for TABLE_MAX edges, and returns how many
+// there are. A Bnnn is assumed to index a table of JPs starting at nnn.
+static int successors(const struct analysis *a, uint32_t addr, const struct mnemonic *mn,
+    struct edge *out) {
+  uint16_t opcode = fetch(a, addr);
+  uint32_t next = addr + instruction_length(opcode);
+  uint32_t target = opcode & 0xFFF;
+
+  switch (mn->flow) {
+    case FLOW_NEXT:
+      out[0] = (struct edge){ next, EDGE_NEXT };
+      return 1;
+
+    case FLOW_SKIP:
+      out[0] = (struct edge){ next, EDGE_NEXT };
+      out[1] = (struct edge){ next + instruction_length(fetch(a, next)), EDGE_SKIP };
+      return 2;
+
+    case FLOW_JUMP:
+      out[0] = (struct edge){ target, EDGE_JUMP };
+      return 1;
+
+    case FLOW_CALL:
+      out[0] = (struct edge){ next, EDGE_NEXT };
+      out[1] = (struct edge){ target, EDGE_CALL };
+      return 2;
+
+    case FLOW_INDIRECT: {
+      int n = 0;
+      out[n++] = (struct edge){ target, EDGE_TABLE };
+      while (n < TABLE_MAX && in_rom(a, target + n * 2) &&
+          (fetch(a, target + n * 2) & 0xF000) == 0x1000) {
+        out[n] = (struct edge){ target + n * 2, EDGE_TABLE };
+        n++;
+      }
+      return n;
+    }
+
+    default:
+      return 0;
+  }
+}
+
+// Follows every path from 0x200 to separate code from data
+static void trace_code(struct analysis *a) {
+  static uint32_t work[MEMORY_SIZE];
+  size_t n = 0;
+
+  work[n++] = ROM_START;
+  a->marks[ROM_START] |= ADDR_SEEN | ADDR_LEADER;
+
+  while (n > 0) {
+    uint32_t addr = work[--n];
+    uint16_t opcode = fetch(a, addr);
+    const struct mnemonic *mn = find_mnemonic(opcode);
+    size_t len = instruction_length(opcode);
+    if (mn == NULL || addr + len > a->end) {
+      a->unknown++;
+      continue;
+    }
+
+    a->marks[addr] |= ADDR_CODE;
+    a->counts[mn - mnemonics]++;
+    a->instructions++;
+    a->code_bytes += len;
+    if (mn->isa > a->isa) {
+      a->isa = mn->isa;
+    }
+    a->quirks |= mn->quirks;
+
+    struct edge out[TABLE_MAX];
+    int count = successors(a, addr, mn, out);
+    for (int i = 0; i < count; i++) {
+      uint32_t to = out[i].to;
+      if (!in_rom(a, to)) {
+        a->outside++;
+        continue;
+      }
+
+      // Anything other than carrying straight on starts a new block
+      if (mn->flow != FLOW_NEXT) {
+        a->marks[to] |= ADDR_LEADER;
+      }
+      if (out[i].kind == EDGE_JUMP || out[i].kind == EDGE_CALL || out[i].kind == EDGE_TABLE) {
+        a->marks[to] |= ADDR_LABEL;
+      }
+      if (!(a->marks[to] & ADDR_SEEN)) {
+        a->marks[to] |= ADDR_SEEN;
+        work[n++] = to;
+      }
+    }
+  }
+}
+
+static void analyse(struct analysis *a, const char *name, const uint8_t *rom, size_t size) {
+  a->name = name;
+  a->size = size;
+  a->end = ROM_START + size;
+  memset(a->memory, 0, sizeof(a->memory));
+  memset(a->marks, 0, sizeof(a->marks));
+  memcpy(&a->memory[ROM_START], rom, size);
+  memset(a->counts, 0, mnemonic_count * sizeof(*a->counts));
+  a->instructions = a->code_bytes = a->unknown = a->outside = 0;
+  a->isa = ISA_CHIP8;
+  a->quirks = 0;
+
+  trace_code(a);
+}
+
+// Output
+
+// Whether the block carries on past the instruction at addr
+static int block_continues(const struct analysis *a, uint32_t addr, const struct mnemonic *mn) {
+  uint32_t next = addr + instruction_length(fetch(a, addr));
+  return mn->flow == FLOW_NEXT && in_rom(a, next) &&
+      (a->marks[next] & (ADDR_CODE | ADDR_LEADER)) == ADDR_CODE;
+}
+
+static void print_listing(const struct analysis *a) {
+  printf("; %s\n", a->name);
+
+  for (uint32_t addr = ROM_START; addr < a->end;) {
+    uint8_t mark = a->marks[addr];
+
+    if (!(mark & ADDR_CODE)) {
+      // Data, drawn out a pixel per bit as it's mostly sprites
+      uint8_t byte = a->memory[addr];
+      char pixels[9];
+      for (int i = 0; i < 8; i++) {
+        pixels[i] = byte & (0x80 >> i) ? '#' : '.';
+      }
+      pixels[8] = '\0';
+      printf("0x%03X  %02X    DB 0x%02X  %s\n", addr, byte, byte, pixels);
+      addr++;
+      continue;
+    }
+
+    if (mark & ADDR_LABEL) {
+      printf("\nL%03X:\n", addr);
+    }
+
+    char text[32];
+    uint16_t opcode = fetch(a, addr);
+    size_t len = disassemble(opcode, fetch(a, addr + 2), text, sizeof(text));
+    printf("0x%03X  %04X  %s\n", addr, opcode, text);
+    addr += len;
+  }
+}
+
+static const char *const edge_styles[] = {
+  [EDGE_NEXT] = "",
+  [EDGE_SKIP] = " [label=\"skip\"]",
+  [EDGE_JUMP] = " [style=bold]",
+  [EDGE_CALL] = " [style=dashed]",
+  [EDGE_TABLE] = " [style=dotted]",
+};
+
+// Writes the basic blocks and the edges between them as a DOT digraph
+static void print_graph(const struct analysis *a) {
+  printf("digraph \"%s\" {\n", a->name);
+  printf("  node [shape=box fontname=monospace];\n");
+
+  for (uint32_t addr = ROM_START; addr < a->end;) {
+    if (!(a->marks[addr] & ADDR_CODE)) {
+      addr++;
+      continue;
+    }
+
+    // Gather the block's instructions into its label
+    uint32_t start = addr;
+    const struct mnemonic *mn;
+    printf("  b%03X [label=\"", start);
+    for (;;) {
+      char text[32];
+      uint16_t opcode = fetch(a, addr);
+      mn = find_mnemonic(opcode);
+      disassemble(opcode, fetch(a, addr + 2), text, sizeof(text));
+      printf("0x%03X  %s\\l", addr, text);
+      if (!block_continues(a, addr, mn)) {
+        break;
+      }
+      addr += instruction_length(opcode);
+    }
+    printf("\"];\n");
+
+    struct edge out[TABLE_MAX];
+    int count = successors(a, addr, mn, out);
+    for (int i = 0; i < count; i++) {
+      if (in_rom(a, out[i].to) && (a->marks[out[i].to] & ADDR_CODE)) {
+        printf("  b%03X -> b%03X%s;\n", start, out[i].to, edge_styles[out[i].kind]);
+      }
+    }
+
+    addr += instruction_length(fetch(a, addr));
+  }
+
+  printf("}\n");
+}
+
+struct mix_entry {
+  uint64_t count;
+  size_t index;
+};
+
+// Most used first, table order between equals
+static int compare_mix(const void *pa, const void *pb) {
+  const struct mix_entry *a = pa;
+  const struct mix_entry *b = pb;
+  if (a->count != b->count) {
+    return a->count < b->count ? 1 : -1;
+  }
+  return a->index < b->index ? -1 : 1;
+}
+
+// Sorts the mnemonics by how often they're used, returns how many were
+static size_t sort_mix(struct mix_entry *mix, const uint32_t *counts32, const uint64_t *counts64) {
+  size_t n = 0;
+  for (size_t i = 0; i < mnemonic_count; i++) {
+    uint64_t count = counts32 ? counts32[i] : counts64[i];
+    if (count > 0) {
+      mix[n++] = (struct mix_entry){ count, i };
+    }
+  }
+  qsort(mix, n, sizeof(*mix), compare_mix);
+  return n;
+}
+
+static void print_quirks(uint8_t quirks) {
+  printf("  quirks:");
+  if (quirks == 0) {
+    printf(" none");
+  }
+  for (int i = 0; i < QUIRK_COUNT; i++) {
+    if (quirks & (1 << i)) {
+      printf(" %s", quirk_names[i]);
+    }
+  }
+  printf("\n");
+}
+
+static void print_summary(const struct analysis *a, struct mix_entry *mix) {
+  printf("%s: %u bytes, %u code, %u data, %u instructions, %s\n", a->name, a->size,
+      a->code_bytes, a->size - a->code_bytes, a->instructions, isa_names[a->isa]);
+  print_quirks(a->quirks);
+  if (a->unknown > 0 || a->outside > 0) {
+    printf("  paths ending in unknown opcodes: %u, leaving the ROM: %u\n", a->unknown, a->outside);
+  }
+
+  size_t n = sort_mix(mix, a->counts, NULL);
+  printf("  mix:");
+  for (size_t i = 0; i < n; i++) {
+    char pattern[10];
+    opcode_pattern(&mnemonics[mix[i].index], pattern);
+    printf(" %s %lu%s", pattern, (unsigned long)mix[i].count, i + 1 < n ? "," : "");
+  }
+  printf("\n");
+}
+
+static void add_totals(struct totals *t, const struct analysis *a) {
+  t->roms++;
+  t->bytes += a->size;
+  t->code_bytes += a->code_bytes;
+  t->isa[a->isa]++;
+  for (int i = 0; i < QUIRK_COUNT; i++) {
+    if (a->quirks & (1 << i)) {
+      t->quirks[i]++;
+    }
+  }
+  for (size_t i = 0; i < mnemonic_count; i++) {
+    t->counts[i] += a->counts[i];
+    t->roms_using[i] += a->counts[i] > 0;
+  }
+}
+
+static void print_totals(const struct totals *t, struct mix_entry *mix) {
+  printf("\nTotals: %u ROMs, %lu bytes, %lu code\n", t->roms,
+      (unsigned long)t->bytes, (unsigned long)t->code_bytes);
+  printf("  sets:");
+  for (int i = 0; i < 3; i++) {
+    printf(" %s %u%s", isa_names[i], t->isa[i], i < 2 ? "," : "\n");
+  }
+  printf("  quirks:");
+  for (int i = 0; i < QUIRK_COUNT; i++) {
+    printf(" %s %u%s", quirk_names[i], t->quirks[i], i < QUIRK_COUNT - 1 ? "," : "\n");
+  }
+  printf("\n  Opcode          Instructions  ROMs\n");
+  size_t n = sort_mix(mix, NULL, t->counts);
+  for (size_t i = 0; i < n; i++) {
+    const struct mnemonic *mn = &mnemonics[mix[i].index];
+    char pattern[10];
+    char name[8];
+    opcode_pattern(mn, pattern);
+    sscanf(mn->format, "%7s", name);
+    printf("  %-9s %-5s %12lu  %4u\n", pattern, name, (unsigned long)mix[i].count,
+        t->roms_using[mix[i].index]);
+  }
+}
+
+int main(int argc, char **argv) {
+
+  char *pack_path = NULL;
+  int listing = 0;
+  int graph = 0;
+  int summary = 0;
+
+  static struct analysis a;
+  struct totals totals = { 0 };
+  a.counts = calloc(mnemonic_count, sizeof(*a.counts));
+  totals.counts = calloc(mnemonic_count, sizeof(*totals.counts));
+  totals.roms_using = calloc(mnemonic_count, sizeof(*totals.roms_using));
+  struct mix_entry *mix = malloc(mnemonic_count * sizeof(*mix));
+  const char **paths = calloc(argc, sizeof(*paths));
+  int npaths = 0;
+  if (a.counts == NULL || totals.counts == NULL || totals.roms_using == NULL ||
+      mix == NULL || paths == NULL) {
+    exit(EXIT_FAILURE);
+  }
+
+  // Parse arguments, anything that isn't an option is a ROM
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-l")) {
+      listing = 1;
+    } else if (!strcmp(argv[i], "-g")) {
+      graph = 1;
+    } else if (!strcmp(argv[i], "-s")) {
+      summary = 1;
+    } else if (!strcmp(argv[i], "-p")) {
+      if (i == argc-1) {
+        print_usage();
+      }
+      pack_path = argv[++i];
+    } else if (argv[i][0] == '-') {
+      print_usage();
+    } else {
+      paths[npaths++] = argv[i];
+    }
+  }
+
+  if (npaths == 0 && pack_path == NULL) {
+    print_usage();
+  }
+  if (!listing && !graph && !summary) {
+    listing = 1;
+  }
+
+  struct rompack pack = { 0 };
+  if (pack_path != NULL && rompack_open(&pack, pack_path) < 0) {
+    fprintf(stderr, "Couldn't open ROM pack %s\n", pack_path);
+    exit(EXIT_FAILURE);
+  }
+
+  static uint8_t buffer[ROM_MAX];
+  uint32_t total = pack.count + npaths;
+  uint64_t start = now_ns();
+
+  for (uint32_t i = 0; i < total; i++) {
+    const char *name;
+    const uint8_t *rom;
+    size_t size;
+
+    if (i < pack.count) {
+      name = pack.entries[i].name;
+      rom = rompack_data(&pack, &pack.entries[i]);
+      size = pack.entries[i].size;
+    } else {
+      name = paths[i - pack.count];
+      long read_bytes = read_rom(buffer, name);
+      if (read_bytes < 0) {
+        continue;
+      }
+      rom = buffer;
+      size = read_bytes;
+    }
+
+    analyse(&a, name, rom, size);
+    add_totals(&totals, &a);
+
+    if (listing) {
+      print_listing(&a);
+    }
+    if (graph) {
+      print_graph(&a);
+    }
+    if (summary) {
+      print_summary(&a, mix);
+    }
+  }
+
+  if (summary && totals.roms > 1) {
+    print_totals(&totals, mix);
+  }
+
+  fprintf(stderr, "Analysed %u ROMs in %.2fms\n", totals.roms, (now_ns() - start) / 1e6);
+
+  rompack_close(&pack);
+  free(a.counts);
+  free(totals.counts);
+  free(totals.roms_using);
+  free(mix);
+  free(paths);
+
+  return 0;
+}
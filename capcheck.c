@@ -0,0 +1,95 @@
+//
+// Checks capture records never outgrow CAPTURE_RECORD_MAX and decode back to
+// the frame that was encoded
+//
+// The worst case for the RLE alternates a lone literal with a run of two in
+// every row. Random frames of varying density are thrown in on top.
+//
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "capture.h"
+
+// Sets a machine's display from packed rows, the reverse of what capture does
+static void unpack(struct machine *m, const uint8_t *rows) {
+  for (int y = 0; y < GFX_HI_HEIGHT; y++) {
+    const uint8_t *row = &rows[y * CAPTURE_ROW];
+    for (int p = 0; p < GFX_PLANES; p++) {
+      for (int w = 0; w < GFX_WORDS; w++) {
+        uint64_t word = 0;
+        for (int b = 0; b < 8; b++) {
+          word = word << 8 | *row++;
+        }
+        m->gfx[p][y][w] = word;
+      }
+    }
+  }
+}
+
+// Encodes rows into a buffer exactly CAPTURE_RECORD_MAX long and decodes them
+// again, returning the record's length or 0 if it didn't come back the same
+static size_t round_trip(struct capture_frame *last, struct capture_frame *decoded,
+    struct machine *m, const uint8_t *rows) {
+  uint8_t *buf = malloc(CAPTURE_RECORD_MAX);
+  if (buf == NULL) {
+    exit(EXIT_FAILURE);
+  }
+
+  unpack(m, rows);
+  size_t n = capture_encode(last, m, 1, buf);
+
+  uint64_t frames_since;
+  long used = capture_decode(decoded, buf, n, &frames_since);
+  free(buf);
+
+  if (n > CAPTURE_RECORD_MAX || used != (long)n ||
+      memcmp(decoded->rows, rows, CAPTURE_FRAME)) {
+    return 0;
+  }
+  return n;
+}
+
+int main() {
+  static struct machine m;
+  static struct capture_frame last, decoded;
+  static uint8_t rows[CAPTURE_FRAME];
+  int failures = 0;
+
+  // 1, 2, 2, 3, 4, 4, ... against a blank frame: no neighbouring literals
+  // ever match, and every run is two long
+  m.hires = 1;
+  for (int i = 0; i < CAPTURE_FRAME; i++) {
+    int col = i % CAPTURE_ROW;
+    rows[i] = (col / 3) * 2 + (col % 3 == 0 ? 1 : 2);
+  }
+  size_t n = round_trip(&last, &decoded, &m, rows);
+  size_t worst = 2 + GFX_HI_HEIGHT * (1 + CAPTURE_RLE_MAX) + 1;
+  if (n != worst) {
+    fprintf(stderr, "worst case frame took %zu bytes, expected %zu\n", n, worst);
+    failures++;
+  }
+
+  srand(1);
+  for (int i = 0; i < 10000; i++) {
+    int density = rand() % 8;
+    for (int j = 0; j < CAPTURE_FRAME; j++) {
+      rows[j] = rand() % 8 < density ? rand() : rows[j];
+    }
+    // Always something to record
+    rows[rand() % CAPTURE_FRAME] ^= 1 + rand() % 255;
+    m.hires = rand() & 1;
+    if (round_trip(&last, &decoded, &m, rows) == 0) {
+      fprintf(stderr, "random frame %d didn't round trip\n", i);
+      failures++;
+    }
+  }
+
+  if (failures > 0) {
+    return EXIT_FAILURE;
+  }
+
+  printf("Capture records fit in %d bytes and decode back\n", CAPTURE_RECORD_MAX);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,264 @@
+//
+// Converts a capture into a Y4M video or a sequence of PNGs
+//
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "capture.h"
+#include "palette.h"
+
+// Usage instructions for the converter
+int print_usage() {
+  printf(
+"Usage: dip-cap -i [path_to_capture] [-y path_to_y4m | -p png_prefix] [-s scale]\n\n"
+"  -i [path_to_capture]   Capture to convert\n"
+"  -y [path_to_y4m]       Write a 60fps Y4M video, - for stdout\n"
+"  -p [png_prefix]        Write a PNG per changed frame, prefix_000123.png\n"
+"  -s [scale]             Size of a hi-res pixel in the output (default 4)\n");
+
+  exit(EXIT_SUCCESS);
+}
+
+// Y4M
+
+// Writes a frame as planar 4:4:4 YUV
+static void write_y4m_frame(FILE *fp, const struct capture_frame *f, int scale) {
+  // BT.601 studio range for each palette entry
+  static uint8_t yuv[4][3];
+  static int ready;
+  if (!ready) {
+    for (int i = 0; i < 4; i++) {
+      double r = palette_red(i), g = palette_green(i), b = palette_blue(i);
+      yuv[i][0] = 16 + (65.481 * r + 128.553 * g + 24.966 * b) / 255;
+      yuv[i][1] = 128 + (-37.797 * r - 74.203 * g + 112.0 * b) / 255;
+      yuv[i][2] = 128 + (112.0 * r - 93.786 * g - 18.214 * b) / 255;
+    }
+    ready = 1;
+  }
+
+  int width = GFX_HI_WIDTH * scale;
+  uint8_t line[GFX_HI_WIDTH * 16];
+
+  fputs("FRAME\n", fp);
+  for (int c = 0; c < 3; c++) {
+    for (int y = 0; y < GFX_HI_HEIGHT * scale; y++) {
+      for (int x = 0; x < width; x++) {
+        line[x] = yuv[capture_pixel(f, x / scale, y / scale)][c];
+      }
+      fwrite(line, 1, width, fp);
+    }
+  }
+}
+
+// PNG
+
+static uint32_t crc_table[256];
+
+static void make_crc_table() {
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t c = n;
+    for (int k = 0; k < 8; k++) {
+      c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+    }
+    crc_table[n] = c;
+  }
+}
+
+static uint32_t crc(uint32_t c, const uint8_t *buf, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    c = crc_table[(c ^ buf[i]) & 0xFF] ^ (c >> 8);
+  }
+  return c;
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static void write_chunk(FILE *fp, const char *type, const uint8_t *data, size_t len) {
+  uint8_t head[8];
+  put_be32(head, len);
+  memcpy(head + 4, type, 4);
+  fwrite(head, 1, 8, fp);
+  fwrite(data, 1, len, fp);
+
+  uint8_t tail[4];
+  put_be32(tail, crc(crc(0xFFFFFFFF, head + 4, 4), data, len) ^ 0xFFFFFFFF);
+  fwrite(tail, 1, 4, fp);
+}
+
+// Writes a frame as an 8-bit RGB PNG
+// The image data goes in stored zlib blocks, the frames are tiny and this
+// keeps the converter free of any dependencies.
+static int write_png(const char *path, const struct capture_frame *f, int scale) {
+  uint32_t width = GFX_HI_WIDTH * scale;
+  uint32_t height = GFX_HI_HEIGHT * scale;
+  size_t stride = 1 + width * 3;
+  size_t raw_len = stride * height;
+
+  // Filter byte then RGB for every line
+  uint8_t *raw = malloc(raw_len);
+  // zlib header, a 5 byte header per 65535 byte block, and the adler32
+  uint8_t *idat = malloc(2 + raw_len + (raw_len / 65535 + 1) * 5 + 4);
+  if (raw == NULL || idat == NULL) {
+    free(raw);
+    free(idat);
+    return -1;
+  }
+
+  for (uint32_t y = 0; y < height; y++) {
+    uint8_t *p = &raw[y * stride];
+    *p++ = 0;
+    for (uint32_t x = 0; x < width; x++) {
+      int colour = capture_pixel(f, x / scale, y / scale);
+      *p++ = palette_red(colour);
+      *p++ = palette_green(colour);
+      *p++ = palette_blue(colour);
+    }
+  }
+
+  size_t n = 0;
+  idat[n++] = 0x78;
+  idat[n++] = 0x01;
+  for (size_t off = 0; off < raw_len; ) {
+    size_t len = raw_len - off > 65535 ? 65535 : raw_len - off;
+    idat[n++] = off + len == raw_len;
+    idat[n++] = len;
+    idat[n++] = len >> 8;
+    idat[n++] = ~len;
+    idat[n++] = ~len >> 8;
+    memcpy(&idat[n], &raw[off], len);
+    n += len;
+    off += len;
+  }
+
+  uint32_t a = 1, b = 0;
+  for (size_t i = 0; i < raw_len; i++) {
+    a = (a + raw[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  put_be32(&idat[n], b << 16 | a);
+  n += 4;
+
+  FILE *fp = fopen(path, "wb");
+  if (fp == NULL) {
+    perror(path);
+    free(raw);
+    free(idat);
+    return -1;
+  }
+
+  static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+  fwrite(signature, 1, sizeof(signature), fp);
+
+  uint8_t ihdr[13] = { 0 };
+  put_be32(ihdr, width);
+  put_be32(ihdr + 4, height);
+  ihdr[8] = 8; // Bit depth
+  ihdr[9] = 2; // RGB
+  write_chunk(fp, "IHDR", ihdr, sizeof(ihdr));
+  write_chunk(fp, "IDAT", idat, n);
+  write_chunk(fp, "IEND", NULL, 0);
+
+  free(raw);
+  free(idat);
+
+  return fclose(fp);
+}
+
+int main(int argc, char **argv) {
+
+  char *in_path = NULL;
+  char *y4m_path = NULL;
+  char *png_prefix = NULL;
+  int scale = 4;
+
+  // Parse arguments
+  for (int i = 1; i < argc; i++) {
+    if (i == argc-1) {
+      print_usage();
+    } else if (!strcmp(argv[i], "-i")) {
+      in_path = argv[++i];
+    } else if (!strcmp(argv[i], "-y")) {
+      y4m_path = argv[++i];
+    } else if (!strcmp(argv[i], "-p")) {
+      png_prefix = argv[++i];
+    } else if (!strcmp(argv[i], "-s")) {
+      scale = atoi(argv[++i]);
+    } else {
+      print_usage();
+    }
+  }
+
+  if (in_path == NULL || (y4m_path == NULL) == (png_prefix == NULL) ||
+      scale < 1 || scale > 16) {
+    print_usage();
+  }
+
+  struct capture_reader r;
+  if (capture_reader_open(&r, in_path) < 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  FILE *y4m = NULL;
+  if (y4m_path != NULL) {
+    y4m = strcmp(y4m_path, "-") ? fopen(y4m_path, "wb") : stdout;
+    if (y4m == NULL) {
+      perror(y4m_path);
+      exit(EXIT_FAILURE);
+    }
+    fprintf(y4m, "YUV4MPEG2 W%d H%d F%u:1 Ip A1:1 C444\n",
+        GFX_HI_WIDTH * scale, GFX_HI_HEIGHT * scale, r.rate);
+  } else {
+    make_crc_table();
+  }
+
+  // The frame showing before each record, repeated to fill the gap in video
+  struct capture_frame shown = { 0 };
+  uint64_t shown_number = 0;
+  uint64_t records = 0;
+  int status;
+
+  while ((status = capture_read(&r)) > 0) {
+    if (y4m != NULL) {
+      for (; records > 0 && shown_number < r.frame_number; shown_number++) {
+        write_y4m_frame(y4m, &shown, scale);
+      }
+      shown = r.frame;
+      shown_number = r.frame_number;
+    } else {
+      char path[4096];
+      snprintf(path, sizeof(path), "%s_%06llu.png", png_prefix,
+          (unsigned long long)r.frame_number);
+      if (write_png(path, &r.frame, scale) != 0) {
+        exit(EXIT_FAILURE);
+      }
+    }
+    records++;
+  }
+
+  if (status < 0) {
+    fprintf(stderr, "Capture is corrupt after %llu frames\n", (unsigned long long)records);
+  }
+
+  // The last frame holds for a single frame
+  if (y4m != NULL) {
+    if (records > 0) {
+      write_y4m_frame(y4m, &shown, scale);
+    }
+    if (y4m != stdout) {
+      fclose(y4m);
+    }
+  }
+
+  capture_reader_close(&r);
+
+  fprintf(stderr, "Converted %llu frames\n", (unsigned long long)records);
+
+  return status < 0 ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,366 @@
+//
+// Headless frame capture to a delta-encoded stream, and reading it back
+//
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "capture.h"
+
+// Encoding
+
+static size_t put_varint(uint8_t *out, uint64_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    out[n++] = (v & 0x7F) | 0x80;
+    v >>= 7;
+  }
+  out[n++] = v;
+  return n;
+}
+
+// Lays a display line out as bytes, both planes, left-most pixel first
+static void pack_row(const struct machine *m, int y, uint8_t *row) {
+  for (int p = 0; p < GFX_PLANES; p++) {
+    for (int w = 0; w < GFX_WORDS; w++) {
+      uint64_t word = m->gfx[p][y][w];
+      for (int b = 0; b < 8; b++) {
+        *row++ = word >> (56 - b * 8);
+      }
+    }
+  }
+}
+
+// Run-length encodes a row of XORed bytes
+// Writes at most CAPTURE_RLE_MAX bytes.
+static size_t rle_row(const uint8_t *delta, uint8_t *out) {
+  size_t n = 0;
+  int i = 0;
+
+  while (i < CAPTURE_ROW) {
+    // Runs of two or more repeat the byte
+    int run = 1;
+    while (i + run < CAPTURE_ROW && run < 129 && delta[i + run] == delta[i]) {
+      run++;
+    }
+    if (run >= 2) {
+      out[n++] = run + 126;
+      out[n++] = delta[i];
+      i += run;
+      continue;
+    }
+
+    // Otherwise gather literals up to the next run
+    int start = i;
+    while (i < CAPTURE_ROW && i - start < 128 &&
+        !(i + 1 < CAPTURE_ROW && delta[i + 1] == delta[i])) {
+      i++;
+    }
+    out[n++] = i - start - 1;
+    memcpy(&out[n], &delta[start], i - start);
+    n += i - start;
+  }
+
+  return n;
+}
+
+// Encodes a record of the rows of m that differ from last, and updates last
+// Returns 0 if the display is unchanged and there's nothing to record.
+size_t capture_encode(struct capture_frame *last, const struct machine *m,
+    uint64_t frames_since, uint8_t *out) {
+  size_t n = put_varint(out, frames_since);
+  out[n++] = m->hires;
+
+  int changed = m->hires != last->hires;
+  last->hires = m->hires;
+
+  for (int y = 0; y < GFX_HI_HEIGHT; y++) {
+    uint8_t row[CAPTURE_ROW];
+    uint8_t *prev = &last->rows[y * CAPTURE_ROW];
+    pack_row(m, y, row);
+
+    if (!memcmp(row, prev, CAPTURE_ROW)) {
+      continue;
+    }
+
+    uint8_t delta[CAPTURE_ROW];
+    for (int i = 0; i < CAPTURE_ROW; i++) {
+      delta[i] = row[i] ^ prev[i];
+    }
+    memcpy(prev, row, CAPTURE_ROW);
+
+    out[n++] = y;
+    n += rle_row(delta, &out[n]);
+    changed = 1;
+  }
+
+  out[n++] = CAPTURE_END;
+
+  return changed ? n : 0;
+}
+
+// Recording
+
+static void *writer_main(void *arg) {
+  struct capture *c = arg;
+
+  pthread_mutex_lock(&c->lock);
+  for (;;) {
+    while (c->pending < 0 && !c->quit) {
+      pthread_cond_wait(&c->cond, &c->lock);
+    }
+    if (c->pending < 0) {
+      break;
+    }
+
+    // Write without holding the lock so the emulator can keep filling the
+    // other buffer
+    int i = c->pending;
+    pthread_mutex_unlock(&c->lock);
+    fwrite(c->batch[i], 1, c->length[i], c->fp);
+    pthread_mutex_lock(&c->lock);
+
+    c->length[i] = 0;
+    c->pending = -1;
+    pthread_cond_broadcast(&c->cond);
+  }
+  pthread_mutex_unlock(&c->lock);
+
+  return NULL;
+}
+
+// Hands the buffer being filled to the writer, waiting if it's still busy
+// with the last one
+static void flush_batch(struct capture *c) {
+  pthread_mutex_lock(&c->lock);
+  while (c->pending >= 0) {
+    pthread_cond_wait(&c->cond, &c->lock);
+  }
+  c->pending = c->filling;
+  c->filling ^= 1;
+  pthread_cond_broadcast(&c->cond);
+  pthread_mutex_unlock(&c->lock);
+}
+
+// Starts recording to path
+// Returns -1 if the file couldn't be opened.
+int capture_open(struct capture *c, const char *path) {
+  memset(c, 0, sizeof(*c));
+  c->pending = -1;
+
+  c->fp = fopen(path, "wb");
+  if (c->fp == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  c->batch[0] = malloc(CAPTURE_BATCH);
+  c->batch[1] = malloc(CAPTURE_BATCH);
+  if (c->batch[0] == NULL || c->batch[1] == NULL) {
+    free(c->batch[0]);
+    free(c->batch[1]);
+    fclose(c->fp);
+    c->fp = NULL;
+    return -1;
+  }
+
+  struct capture_header header = {
+    .magic = CAPTURE_MAGIC,
+    .version = CAPTURE_VERSION,
+    .rate = CAPTURE_RATE
+  };
+  memcpy(c->batch[0], &header, sizeof(header));
+  c->length[0] = sizeof(header);
+
+  pthread_mutex_init(&c->lock, NULL);
+  pthread_cond_init(&c->cond, NULL);
+  pthread_create(&c->thread, NULL, writer_main, c);
+
+  return 0;
+}
+
+// Flushes everything recorded so far and stops recording
+void capture_close(struct capture *c) {
+  if (c->fp == NULL) {
+    return;
+  }
+
+  flush_batch(c);
+
+  pthread_mutex_lock(&c->lock);
+  c->quit = 1;
+  pthread_cond_broadcast(&c->cond);
+  pthread_mutex_unlock(&c->lock);
+  pthread_join(c->thread, NULL);
+
+  pthread_mutex_destroy(&c->lock);
+  pthread_cond_destroy(&c->cond);
+  fclose(c->fp);
+  free(c->batch[0]);
+  free(c->batch[1]);
+  c->fp = NULL;
+}
+
+// Records the display of m as it stands at frame
+// Frames where nothing changed cost a row compare and nothing more.
+void capture_frame(struct capture *c, const struct machine *m, uint64_t frame) {
+  if (c->fp == NULL) {
+    return;
+  }
+
+  // Make sure a whole record fits before encoding straight into the batch
+  if (c->length[c->filling] + CAPTURE_RECORD_MAX > CAPTURE_BATCH) {
+    flush_batch(c);
+  }
+
+  int i = c->filling;
+  size_t n = capture_encode(&c->last, m, frame - c->last_frame,
+      c->batch[i] + c->length[i]);
+  if (n == 0) {
+    return;
+  }
+
+  c->length[i] += n;
+  c->last_frame = frame;
+  c->frames++;
+  c->bytes += n;
+}
+
+// Playback
+
+static int get_varint(const uint8_t *buf, size_t len, size_t *pos, uint64_t *v) {
+  *v = 0;
+  for (int shift = 0; shift < 64 && *pos < len; shift += 7) {
+    uint8_t b = buf[(*pos)++];
+    *v |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Undoes rle_row, XORing the row straight into the frame
+static int unrle_row(const uint8_t *buf, size_t len, size_t *pos, uint8_t *row) {
+  int i = 0;
+
+  while (i < CAPTURE_ROW) {
+    if (*pos >= len) {
+      return -1;
+    }
+    int ctl = buf[(*pos)++];
+
+    if (ctl < 128) {
+      if (i + ctl + 1 > CAPTURE_ROW || *pos + ctl + 1 > len) {
+        return -1;
+      }
+      for (int j = 0; j <= ctl; j++) {
+        row[i++] ^= buf[(*pos)++];
+      }
+    } else {
+      if (i + ctl - 126 > CAPTURE_ROW || *pos >= len) {
+        return -1;
+      }
+      uint8_t b = buf[(*pos)++];
+      for (int j = 0; j < ctl - 126; j++) {
+        row[i++] ^= b;
+      }
+    }
+  }
+
+  return 0;
+}
+
+// Applies a single record to a frame
+// Returns how many bytes the record took up, or -1 if it's corrupt or cut
+// short.
+long capture_decode(struct capture_frame *f, const uint8_t *buf, size_t len,
+    uint64_t *frames_since) {
+  size_t pos = 0;
+
+  if (get_varint(buf, len, &pos, frames_since) < 0 || pos >= len) {
+    return -1;
+  }
+  f->hires = buf[pos++] & 1;
+
+  for (;;) {
+    if (pos >= len) {
+      return -1;
+    }
+    int y = buf[pos++];
+    if (y == CAPTURE_END) {
+      return pos;
+    }
+    if (y >= GFX_HI_HEIGHT || unrle_row(buf, len, &pos, &f->rows[y * CAPTURE_ROW]) < 0) {
+      return -1;
+    }
+  }
+}
+
+// Opens a capture for playback
+// Captures are small so the whole file is read in up front. Returns -1 if it
+// can't be read or isn't a capture.
+int capture_reader_open(struct capture_reader *r, const char *path) {
+  memset(r, 0, sizeof(*r));
+
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  rewind(fp);
+
+  struct capture_header header;
+  if (size < (long)sizeof(header) || fread(&header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) ||
+      header.version != CAPTURE_VERSION) {
+    fprintf(stderr, "Not a capture: %s\n", path);
+    fclose(fp);
+    return -1;
+  }
+
+  r->length = size - sizeof(header);
+  r->data = malloc(r->length + 1);
+  if (r->data == NULL || fread(r->data, 1, r->length, fp) != r->length) {
+    fprintf(stderr, "Couldn't read %s\n", path);
+    free(r->data);
+    r->data = NULL;
+    fclose(fp);
+    return -1;
+  }
+  fclose(fp);
+
+  r->rate = header.rate;
+
+  return 0;
+}
+
+void capture_reader_close(struct capture_reader *r) {
+  free(r->data);
+  r->data = NULL;
+}
+
+// Applies the next record to the current frame
+// Returns 1 for a new frame, 0 at the end of the capture and -1 if it's
+// corrupt.
+int capture_read(struct capture_reader *r) {
+  if (r->pos == r->length) {
+    return 0;
+  }
+
+  uint64_t frames_since;
+  long n = capture_decode(&r->frame, r->data + r->pos, r->length - r->pos, &frames_since);
+  if (n < 0) {
+    return -1;
+  }
+
+  r->pos += n;
+  r->frame_number += frames_since;
+
+  return 1;
+}
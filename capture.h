@@ -0,0 +1,128 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "cpu.h"
+
+// Capture files
+// A header followed by one record per frame that changed the display. Each
+// record holds only the rows that changed, XORed against the previous frame
+// and run-length encoded, so a typical 60Hz session comes to a few bytes a
+// frame.
+//
+//   header:  magic[8] "DIPCAP", version (u32), frame rate (u32)
+//   record:  frames since the last record (varint), mode (u8, bit 0 hi-res)
+//            then per changed row: row (u8), RLE of CAPTURE_ROW bytes
+//            ended by CAPTURE_END
+//
+// A row is both planes of one display line, plane 0 first, 16 bytes each
+// with the left-most pixel in the top bit. Runs are a control byte c
+// followed either by c + 1 literal bytes (c < 128), or a single byte repeated
+// c - 126 times.
+#define CAPTURE_MAGIC "DIPCAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_RATE 60
+
+#define CAPTURE_PLANE_ROW (GFX_WORDS * 8)
+#define CAPTURE_ROW (GFX_PLANES * CAPTURE_PLANE_ROW)
+#define CAPTURE_FRAME (GFX_HI_HEIGHT * CAPTURE_ROW)
+#define CAPTURE_END 0xFF
+
+// Most bytes a row can take once run-length encoded
+// Every byte of the row, plus a control byte for each block of literals.
+// Blocks alternate literals and runs of at least two, so a new literal block
+// can start at most every third byte.
+#define CAPTURE_RLE_MAX (CAPTURE_ROW + (CAPTURE_ROW + 2) / 3)
+
+// Largest a single record can get: a 64-bit varint, the mode, every row's
+// number and worst case RLE, and the end marker
+#define CAPTURE_RECORD_MAX (10 + 1 + GFX_HI_HEIGHT * (1 + CAPTURE_RLE_MAX) + 1)
+
+// Bytes gathered up before they're handed to the writer thread
+#define CAPTURE_BATCH (64 * 1024)
+
+// Literal blocks hold at most 128 bytes, a longer row could need more control
+// bytes than CAPTURE_RLE_MAX allows for
+_Static_assert(CAPTURE_ROW <= 128,
+    "CAPTURE_RLE_MAX assumes a row of literals fits in one block");
+_Static_assert(CAPTURE_RECORD_MAX <= CAPTURE_BATCH,
+    "a whole record must fit in a batch");
+
+struct capture_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t rate;
+};
+
+// Frames as last written, what the next record is XORed against
+struct capture_frame {
+  uint8_t rows[CAPTURE_FRAME];
+  uint8_t hires;
+};
+
+// Recorder
+// Frames are encoded on the emulation thread into one of two batch buffers,
+// full buffers are written out by a writer thread so the emulator never
+// waits on the disk.
+struct capture {
+  FILE *fp;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  uint8_t *batch[2];
+  size_t length[2];
+  int filling;
+  // Buffer handed to the writer, -1 when it has nothing to do
+  int pending;
+  int quit;
+
+  struct capture_frame last;
+  uint64_t last_frame;
+
+  // Frames recorded and bytes encoded so far
+  uint64_t frames;
+  uint64_t bytes;
+};
+
+int capture_open(struct capture *c, const char *path);
+void capture_close(struct capture *c);
+void capture_frame(struct capture *c, const struct machine *m, uint64_t frame);
+
+size_t capture_encode(struct capture_frame *last, const struct machine *m,
+    uint64_t frames_since, uint8_t *out);
+
+long capture_decode(struct capture_frame *f, const uint8_t *buf, size_t len,
+    uint64_t *frames_since);
+
+// Player, reads a capture back one record at a time
+struct capture_reader {
+  uint8_t *data;
+  size_t length;
+  size_t pos;
+  uint32_t rate;
+  struct capture_frame frame;
+  // Frame number of the current frame
+  uint64_t frame_number;
+};
+
+int capture_reader_open(struct capture_reader *r, const char *path);
+void capture_reader_close(struct capture_reader *r);
+int capture_read(struct capture_reader *r);
+
+// Colour of a pixel in a decoded frame, in hi-res coordinates
+// Lo-res frames are doubled up so every frame comes out at the same size.
+static inline int capture_pixel(const struct capture_frame *f, int x, int y) {
+  if (!f->hires) {
+    x >>= 1;
+    y >>= 1;
+  }
+  const uint8_t *row = &f->rows[y * CAPTURE_ROW + (x >> 3)];
+  int bit = 7 - (x & 7);
+  return ((row[0] >> bit) & 1) | (((row[CAPTURE_PLANE_ROW] >> bit) & 1) << 1);
+}
+
+#endif // CAPTURE_H
@@ -0,0 +1,136 @@
+//
+// Control channel for restarting and swapping ROMs in a running emulator
+//
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "control.h"
+
+static volatile sig_atomic_t restart_requested;
+static volatile sig_atomic_t reload_requested;
+
+static void handle_signal(int sig) {
+  if (sig == SIGUSR1) {
+    restart_requested = 1;
+  } else {
+    reload_requested = 1;
+  }
+}
+
+// Starts listening for commands
+// Signals are always hooked up, the socket only if path is set. Returns -1
+// if the socket couldn't be created.
+int control_open(struct control *ctl, const char *path) {
+  memset(ctl, 0, sizeof(*ctl));
+  ctl->fd = -1;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_signal;
+  sigaction(SIGUSR1, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+
+  if (path == NULL || path[0] == '\0') {
+    return 0;
+  }
+
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Control socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  ctl->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if (ctl->fd < 0) {
+    perror("socket");
+    return -1;
+  }
+
+  // Clear out any socket left behind by an earlier run
+  unlink(path);
+  if (bind(ctl->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("bind");
+    close(ctl->fd);
+    ctl->fd = -1;
+    return -1;
+  }
+
+  fcntl(ctl->fd, F_SETFL, fcntl(ctl->fd, F_GETFL) | O_NONBLOCK);
+  strcpy(ctl->path, path);
+
+  return 0;
+}
+
+void control_close(struct control *ctl) {
+  if (ctl->fd >= 0) {
+    close(ctl->fd);
+    unlink(ctl->path);
+  }
+  ctl->fd = -1;
+}
+
+// Checks for a pending command without blocking
+// For CONTROL_LOAD the ROM to load is copied into arg.
+int control_poll(struct control *ctl, char *arg, size_t arg_size) {
+  if (restart_requested) {
+    restart_requested = 0;
+    return CONTROL_RESTART;
+  }
+
+  if (reload_requested) {
+    reload_requested = 0;
+    return CONTROL_RELOAD;
+  }
+
+  if (ctl->fd < 0) {
+    return CONTROL_NONE;
+  }
+
+  char msg[512];
+  ctl->peer_len = sizeof(ctl->peer);
+  ssize_t n = recvfrom(ctl->fd, msg, sizeof(msg) - 1, 0,
+      (struct sockaddr *)&ctl->peer, &ctl->peer_len);
+  if (n <= 0) {
+    return CONTROL_NONE;
+  }
+
+  // Trim off any trailing newline
+  while (n > 0 && (msg[n - 1] == '\n' || msg[n - 1] == '\r')) {
+    n--;
+  }
+  msg[n] = '\0';
+
+  if (!strcmp(msg, "restart")) {
+    return CONTROL_RESTART;
+  }
+
+  if (!strcmp(msg, "reload")) {
+    return CONTROL_RELOAD;
+  }
+
+  if (!strcmp(msg, "stats")) {
+    return CONTROL_STATS;
+  }
+
+  if (!strncmp(msg, "load ", 5) && msg[5] != '\0' && strlen(msg + 5) < arg_size) {
+    strcpy(arg, msg + 5);
+    return CONTROL_LOAD;
+  }
+
+  fprintf(stderr, "Unknown control command: %s\n", msg);
+  return CONTROL_NONE;
+}
+
+// Answers the sender of the last command, if it has an address to answer to
+void control_reply(struct control *ctl, const char *msg, size_t len) {
+  if (ctl->fd < 0 || ctl->peer_len <= sizeof(sa_family_t)) {
+    return;
+  }
+  sendto(ctl->fd, msg, len, MSG_DONTWAIT, (struct sockaddr *)&ctl->peer, ctl->peer_len);
+}
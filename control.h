@@ -0,0 +1,35 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Commands that can be sent to a running emulator
+enum control_command {
+  CONTROL_NONE,
+  CONTROL_RESTART, // Restart the current ROM
+  CONTROL_RELOAD,  // Read the current ROM again and restart it
+  CONTROL_LOAD,    // Swap in another ROM
+  CONTROL_STATS,   // Reply with the current stats
+};
+
+// Control channel
+// Commands arrive as datagrams on a local UNIX socket, "restart", "reload"
+// or "load [rom]". "stats" is answered with control_reply to whoever sent it.
+// SIGUSR1 restarts and SIGHUP reloads.
+struct control {
+  int fd;
+  char path[108];
+
+  // Sender of the last command
+  struct sockaddr_un peer;
+  socklen_t peer_len;
+};
+
+int control_open(struct control *ctl, const char *path);
+void control_close(struct control *ctl);
+int control_poll(struct control *ctl, char *arg, size_t arg_size);
+void control_reply(struct control *ctl, const char *msg, size_t len);
+
+#endif // CONTROL_H
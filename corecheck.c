@@ -0,0 +1,56 @@
+//
+// Checks the freestanding core reports errors the way it's documented to
+//
+// Built against dip-core.o, the core exactly as it's built for embedded
+// targets, so this runs the same code a microcontroller would.
+//
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+static int failures;
+
+static void expect(const char *what, int got, int want) {
+  if (got != want) {
+    fprintf(stderr, "%s: got %d, wanted %d\n", what, got, want);
+    failures++;
+  }
+}
+
+// Runs the first instruction of a ROM on a fresh machine
+static int first_cycle(struct machine *m, const uint8_t *rom, size_t size) {
+  initialize(m, rom, size);
+  return emulate_cycle(m);
+}
+
+int main() {
+  static struct machine m;
+  static uint8_t big[ROM_MAX + 1];
+
+  static const uint8_t unknown[] = { 0x50, 0x01 }; // 5xy1
+  static const uint8_t halt[] = { 0x00, 0xFD };     // EXIT
+  static const uint8_t ret[] = { 0x00, 0xEE };      // RET with nothing to return to
+  static const uint8_t wait[] = { 0xF0, 0x0A };     // LD V0, K
+
+  expect("unknown opcode", first_cycle(&m, unknown, sizeof(unknown)), MACHINE_FAULT);
+  expect("00FD", first_cycle(&m, halt, sizeof(halt)), MACHINE_HALTED);
+  expect("stack underflow", first_cycle(&m, ret, sizeof(ret)), MACHINE_FAULT);
+  expect("Fx0A", first_cycle(&m, wait, sizeof(wait)), MACHINE_WAIT_KEY);
+
+  // Stopped machines stay stopped
+  first_cycle(&m, unknown, sizeof(unknown));
+  expect("run_frame after a fault", run_frame(&m, 10), MACHINE_FAULT);
+
+  expect("ROM that fills memory", initialize(&m, big, ROM_MAX), 0);
+  expect("oversized ROM", initialize(&m, big, sizeof(big)), -1);
+  expect("mem_top after an oversized ROM", m.mem_top, MEMORY_SIZE);
+
+  if (failures > 0) {
+    return EXIT_FAILURE;
+  }
+
+  printf("Freestanding core reports errors as documented\n");
+  return EXIT_SUCCESS;
+}
@@ -5,69 +5,57 @@ Handles the CPU architecture of the CHIP-8
 Includes all instructions
 
 */
-#include <stdlib.h>
-#include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
-#include <string.h>
-#include <stdarg.h>
 
 #include "cpu.h"
 
-// Flag for whether to update the graphics output or not
-int drawFlag;
-
-// Initialize the registers to 0
-uint8_t registers[16];
-
-// 16-bit index register
-uint16_t I;
-
-// 16-bit program counter
-uint16_t PC = 0x200; // Program counter starts at 0x200
-
-// Stack setup
-uint16_t stack[16];
-// Stack pointer
-uint8_t SP;
-
-// Memory
-// CHIP-8 has 4k of main memory
-uint8_t memory[4096];
-
-// Current opcode
-uint16_t opcode;
-
-// Graphics
-// Screen has a total of 2048 (64 * 32) pixels
-uint8_t gfx[64 * 32];
-
-// Interrupts and timers
-// CHIP-8 has no interrupts but does have 2 timers
-uint8_t delay_timer;
-uint8_t sound_timer;
+#ifdef DIP_FREESTANDING
+// Nothing but these four, which even freestanding compilers expect to be
+// provided, is used from outside the core
+void *memcpy(void *dest, const void *src, size_t n);
+void *memmove(void *dest, const void *src, size_t n);
+void *memset(void *s, int c, size_t n);
+int memcmp(const void *s1, const void *s2, size_t n);
+#else
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
 
-// Keyboard control
-// CHIP-8 has total of 16 keys
-uint8_t key[16];
+#include "disasm.h"
+#endif
 
 // Helpers
 
 // Get a registers value
-uint8_t get_vreg(uint8_t vreg) {
-  return registers[vreg];
+uint8_t get_vreg(struct machine *m, uint8_t vreg) {
+  return m->registers[vreg];
 }
 
+// Whether every instruction is traced to stdout as it runs
+#ifndef DIP_FREESTANDING
+int trace = 1;
+int quiet = 0;
+#endif
+
 // Log out a message
-// TODO: Expand with other log options
+// Freestanding builds have nowhere to log to, so it all compiles away.
+#ifdef DIP_FREESTANDING
+#define logger(...) ((void)0)
+#else
 void logger(const char *pattern, ...) {
+  if (quiet) {
+    return;
+  }
   va_list args;
   va_start(args, pattern);
   vprintf(pattern, args);
   va_end(args);
 }
+#endif
 
 // Fontset from: http://www.multigesture.net/articles/how-to-write-an-emulator-chip-8-interpreter/
-uint8_t chip8_fontset[80] = {
+static const uint8_t chip8_fontset[80] = {
   0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
   0x20, 0x60, 0x20, 0x20, 0x70, // 1
   0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
@@ -86,6 +74,120 @@ uint8_t chip8_fontset[80] = {
   0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
+// SUPER-CHIP 8x10 hex font, with XO-CHIP's A-F
+static const uint8_t chip8_big_fontset[160] = {
+  0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+  0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+  0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+  0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+  0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+  0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+  0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+  0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+  0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+  0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+  0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+  0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+// Random numbers
+// Each machine has its own xorshift state, so RND needs nothing from libc
+// and sessions on different threads don't share anything.
+void seed_random(struct machine *m, uint32_t seed) {
+  // Xorshift never gets out of zero
+  m->rng = seed ? seed : RANDOM_SEED;
+}
+
+static inline uint8_t next_random(struct machine *m) {
+  uint32_t x = m->rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  m->rng = x;
+  return x >> 24;
+}
+
+// Skips the next instruction
+// XO-CHIP's F000 nnnn is twice as long as everything else.
+void skip_next(struct machine *m) {
+  uint16_t next = m->memory[(m->PC + 2) & MEMORY_MASK] << 8 |
+                  m->memory[(m->PC + 3) & MEMORY_MASK];
+  m->PC += next == 0xF000 ? 6 : 4;
+}
+
+// Notes a write to memory so resets know how much to clear
+static inline void touch_memory(struct machine *m, uint32_t end) {
+  if (end > m->mem_top) {
+    m->mem_top = end > MEMORY_SIZE ? MEMORY_SIZE : end;
+  }
+}
+
+// Display helpers
+// Rows are shifted a whole 64-bit word at a time rather than pixel by pixel.
+
+// Rotates a row of width bits right by n, wrapping round to the left
+static inline void rotate_row(uint64_t row[GFX_WORDS], int width, int n) {
+  if (width == 64) {
+    if (n) {
+      row[0] = (row[0] >> n) | (row[0] << (64 - n));
+    }
+    return;
+  }
+
+  if (n >= 64) {
+    uint64_t t = row[0];
+    row[0] = row[1];
+    row[1] = t;
+    n -= 64;
+  }
+  if (n) {
+    uint64_t hi = row[0];
+    uint64_t lo = row[1];
+    row[0] = (hi >> n) | (lo << (64 - n));
+    row[1] = (lo >> n) | (hi << (64 - n));
+  }
+}
+
+// Shifts a row of width bits right by n, or left if n is negative
+static inline void shift_row(uint64_t row[GFX_WORDS], int width, int n) {
+  if (width == 64) {
+    row[0] = n > 0 ? row[0] >> n : row[0] << -n;
+    return;
+  }
+
+  uint64_t hi = row[0];
+  uint64_t lo = row[1];
+  if (n > 0) {
+    row[0] = hi >> n;
+    row[1] = (lo >> n) | (hi << (64 - n));
+  } else {
+    row[0] = (hi << -n) | (lo >> (64 + n));
+    row[1] = lo << -n;
+  }
+}
+
+// Scrolls the selected planes n pixels right, or left if n is negative
+static void scroll_horizontal(struct machine *m, int n) {
+  int width = gfx_width(m);
+  int height = gfx_height(m);
+
+  for (int p = 0; p < GFX_PLANES; p++) {
+    if (m->planes & (1 << p)) {
+      for (int y = 0; y < height; y++) {
+        shift_row(m->gfx[p][y], width, n);
+      }
+    }
+  }
+
+  m->drawFlag = 1;
+  m->dirty = DIRTY_ALL;
+  m->draws++;
+}
+
 
 // Instructions - opcode order
 
@@ -93,65 +195,149 @@ uint8_t chip8_fontset[80] = {
 // Jump to a machine code routine at nnn.
 // This instruction is only used on the old computers on which Chip-8 was
 // originally implemented. It is ignored by modern interpreters.
-void sys(uint16_t nnn) {
-  logger("SYS %X\n", nnn);
-  PC = nnn;
+void sys(struct machine *m, uint16_t nnn) {
+  m->PC = nnn;
 }
 
 // 00E0 - CLS
 // Clear the display.
-void cls() {
-  logger("CLS\n");
-  memset(gfx, 0, 64 * 32);
-  drawFlag = 1;
-  PC += 2;
+void cls(struct machine *m) {
+  // XO-CHIP only clears the selected planes
+  for (int p = 0; p < GFX_PLANES; p++) {
+    if (m->planes & (1 << p)) {
+      memset(m->gfx[p], 0, sizeof(m->gfx[p]));
+    }
+  }
+  m->drawFlag = 1;
+  m->dirty = DIRTY_ALL;
+  m->draws++;
+  m->PC += 2;
 }
 
 // 00EE - RET
 // Return from a subroutine.
 // The interpreter sets the program counter to the address at the top of the
 // stack, then subtracts 1 from the stack pointer.
-void ret() {
-  logger("RET\n");
-  PC = stack[SP];
-  SP--;
+void ret(struct machine *m) {
+  if (m->SP == 0) {
+    logger("Stack underflow at 0x%X\n", m->PC);
+    m->status = MACHINE_FAULT;
+    return;
+  }
+  m->PC = m->stack[m->SP];
+  m->SP--;
+}
+
+// 00Cn - SCD nibble
+// Scroll the display down n pixels (SUPER-CHIP).
+// Only the selected planes are scrolled, rows scrolled in are blank.
+void scd(struct machine *m, uint8_t n) {
+  int height = gfx_height(m);
+  for (int p = 0; p < GFX_PLANES; p++) {
+    if (m->planes & (1 << p)) {
+      memmove(m->gfx[p][n], m->gfx[p][0], (height - n) * sizeof(m->gfx[p][0]));
+      memset(m->gfx[p][0], 0, n * sizeof(m->gfx[p][0]));
+    }
+  }
+
+  m->drawFlag = 1;
+  m->dirty = DIRTY_ALL;
+  m->draws++;
+  m->PC += 2;
+}
+
+// 00Dn - SCU nibble
+// Scroll the display up n pixels (XO-CHIP).
+void scu(struct machine *m, uint8_t n) {
+  int height = gfx_height(m);
+  for (int p = 0; p < GFX_PLANES; p++) {
+    if (m->planes & (1 << p)) {
+      memmove(m->gfx[p][0], m->gfx[p][n], (height - n) * sizeof(m->gfx[p][0]));
+      memset(m->gfx[p][height - n], 0, n * sizeof(m->gfx[p][0]));
+    }
+  }
+
+  m->drawFlag = 1;
+  m->dirty = DIRTY_ALL;
+  m->draws++;
+  m->PC += 2;
+}
+
+// 00FB - SCR
+// Scroll the display right 4 pixels (SUPER-CHIP).
+void scr(struct machine *m) {
+  scroll_horizontal(m, 4);
+  m->PC += 2;
+}
+
+// 00FC - SCL
+// Scroll the display left 4 pixels (SUPER-CHIP).
+void scl(struct machine *m) {
+  scroll_horizontal(m, -4);
+  m->PC += 2;
+}
+
+// 00FD - EXIT
+// Exit the interpreter (SUPER-CHIP).
+void exit_interpreter(struct machine *m) {
+  m->status = MACHINE_HALTED;
+}
+
+// 00FE - LOW
+// Switch to the 64x32 lo-res display (SUPER-CHIP). The display is cleared.
+// 00FF - HIGH
+// Switch to the 128x64 hi-res display (SUPER-CHIP). The display is cleared.
+void set_resolution(struct machine *m, uint8_t hires) {
+  m->hires = hires;
+  memset(m->gfx, 0, sizeof(m->gfx));
+  m->drawFlag = 1;
+  m->dirty = DIRTY_ALL;
+  m->draws++;
+  m->PC += 2;
 }
 
 // 1nnn - JP addr
 // Jump to location nnn.
 // The interpreter sets the program counter to nnn.
-void jp(uint16_t addr) {
-  logger("JP 0x%X\n", addr);
-  PC = addr;
+void jp(struct machine *m, uint16_t addr) {
+  // Nothing can ever get a machine out of a jump to itself
+  if (addr == m->PC) {
+    m->status = MACHINE_STUCK;
+    return;
+  }
+  m->PC = addr;
 }
 
 // 2nnn - CALL addr
 // Call subroutine at nnn.
 // The interpreter increments the stack pointer, then puts the current PC on
 // the top of the stack. The PC is then set to nnn.
-void call_nnn(uint16_t nnn) {
-  logger("CALL 0x%X\n", nnn);
+void call_nnn(struct machine *m, uint16_t nnn) {
+  // Anything deeper would write over the rest of the machine
+  if (m->SP >= STACK_SIZE - 1) {
+    logger("Stack overflow at 0x%X\n", m->PC);
+    m->status = MACHINE_FAULT;
+    return;
+  }
 
   // Increment the stack pointer
-  SP += 1;
+  m->SP += 1;
 
-  stack[SP] = PC + 2;
+  m->stack[m->SP] = m->PC + 2;
 
   // Set PC to nnn
-  PC = nnn;
+  m->PC = nnn;
 }
 
 // 3xkk - SE Vx, byte
 // Skip next instruction if Vx = kk.
 // The interpreter compares register Vx to kk, and if they are equal,
 // increments the program counter by 2.
-void se_vx_yy(uint8_t x, uint8_t yy) {
-  logger("SE V%X, 0x%X\n", x, yy);
-
-  if (registers[x] == yy) {
-    PC += 4;
+void se_vx_yy(struct machine *m, uint8_t x, uint8_t yy) {
+  if (m->registers[x] == yy) {
+    skip_next(m);
   } else {
-    PC += 2;
+    m->PC += 2;
   }
 }
 
@@ -159,13 +345,11 @@ void se_vx_yy(uint8_t x, uint8_t yy) {
 // Skip next instruction if Vx != kk.
 // The interpreter compares register Vx to kk, and if they are not equal,
 // increments the program counter by 2.
-void sne_vx_yy(uint8_t x, uint8_t yy) {
-  logger("SNE V%X, %X\n", x, yy);
-
-  if (registers[x] != yy) {
-    PC += 4;
+void sne_vx_yy(struct machine *m, uint8_t x, uint8_t yy) {
+  if (m->registers[x] != yy) {
+    skip_next(m);
   } else {
-    PC += 2;
+    m->PC += 2;
   }
 }
 
@@ -173,45 +357,66 @@ void sne_vx_yy(uint8_t x, uint8_t yy) {
 // Skip next instruction if Vx = Vy.
 // The interpreter compares register Vx to register Vy, and if they are equal,
 // increments the program counter by 2.
-void se_vx_vy(uint8_t x, uint8_t y) {
-  logger("SE V%X, V%X\n", x, y);
-
-  if (registers[x] == registers[y]) {
-    PC += 4;
+void se_vx_vy(struct machine *m, uint8_t x, uint8_t y) {
+  if (m->registers[x] == m->registers[y]) {
+    skip_next(m);
   } else {
-    PC += 2;
+    m->PC += 2;
   }
 }
 
+// 5xy2 - SAVE Vx - Vy
+// Store registers Vx through Vy in memory starting at location I (XO-CHIP).
+// I is left unchanged, and x may be greater than y to store them backwards.
+void save_vx_vy(struct machine *m, uint8_t x, uint8_t y) {
+  int step = x <= y ? 1 : -1;
+  int n = (x <= y ? y - x : x - y) + 1;
+  for (int i = 0; i < n; i++) {
+    m->memory[(m->I + i) & MEMORY_MASK] = m->registers[x + i * step];
+  }
+  touch_memory(m, m->I + n);
+  m->dirty = DIRTY_ALL;
+
+  m->PC += 2;
+}
+
+// 5xy3 - LOAD Vx - Vy
+// Read registers Vx through Vy from memory starting at location I (XO-CHIP).
+void load_vx_vy(struct machine *m, uint8_t x, uint8_t y) {
+  int step = x <= y ? 1 : -1;
+  int n = (x <= y ? y - x : x - y) + 1;
+  for (int i = 0; i < n; i++) {
+    m->registers[x + i * step] = m->memory[(m->I + i) & MEMORY_MASK];
+  }
+
+  m->PC += 2;
+}
+
 // 6xkk - LD Vx, byte
 // LD Vx, byte
-void ld_vx_yy(uint8_t vx, uint8_t yy) {
-  logger("LD V%X, 0x%X\n", vx, yy);
-  registers[vx] = yy;
+void ld_vx_yy(struct machine *m, uint8_t vx, uint8_t yy) {
+  m->registers[vx] = yy;
 
   // Increment the PC by 2
-  PC += 2;
+  m->PC += 2;
 }
 
 // 7xkk - ADD Vx, byte
 // Set Vx = Vx + kk.
 // Adds the value kk to the value of register Vx, then stores the result in Vx.
-void add_vx_yy(uint8_t x, uint8_t yy) {
-  logger("ADD V%X, 0x%x\n", x, yy);
-  registers[x] = registers[x] + yy;
+void add_vx_yy(struct machine *m, uint8_t x, uint8_t yy) {
+  m->registers[x] = m->registers[x] + yy;
 
-  PC += 2;
+  m->PC += 2;
 }
 
 // 8xy0 - LD Vx, Vy
 // Set Vx = Vy.
 // Stores the value of register Vy in register Vx.
-void ld_vx_vy(uint8_t x, uint8_t y) {
-  logger("LD V%X, V%X\n", x, y);
-
-  registers[x] = registers[y];
+void ld_vx_vy(struct machine *m, uint8_t x, uint8_t y) {
+  m->registers[x] = m->registers[y];
 
-  PC += 2;
+  m->PC += 2;
 }
 
 // 8xy1 - OR Vx, Vy
@@ -219,12 +424,10 @@ void ld_vx_vy(uint8_t x, uint8_t y) {
 // Performs a bitwise OR on the values of Vx and Vy, then stores the result in Vx.
 // A bitwise OR compares the corrseponding bits from two values, and if either bit
 // is 1, then the same bit in the result is also 1. Otherwise, it is 0.
-void or_vx_vy(uint8_t x, uint8_t y) {
-  logger("OR V%X, V%X\n", x, y);
-
-  registers[x] |= registers[y];
+void or_vx_vy(struct machine *m, uint8_t x, uint8_t y) {
+  m->registers[x] |= m->registers[y];
 
-  PC += 2;
+  m->PC += 2;
 }
 
 // 8xy2 - AND Vx, Vy
@@ -232,12 +435,10 @@ void or_vx_vy(uint8_t x, uint8_t y) {
 // Performs a bitwise AND on the values of Vx and Vy, then stores the result in Vx.
 // A bitwise AND compares the corrseponding bits from two values, and if both bits
 // are 1, then the same bit in the result is also 1. Otherwise, it is 0.
-void and_vx_vy(uint8_t x, uint8_t y) {
-  logger("AND V%X, V%X\n", x, y);
+void and_vx_vy(struct machine *m, uint8_t x, uint8_t y) {
+  m->registers[x] = m->registers[x] & m->registers[y];
 
-  registers[x] = registers[x] & registers[y];
-
-  PC += 2;
+  m->PC += 2;
 }
 
 // 8xy3 - XOR Vx, Vy
@@ -246,10 +447,9 @@ void and_vx_vy(uint8_t x, uint8_t y) {
 // result in Vx. An exclusive OR compares the corrseponding bits from two values,
 // and if the bits are not both the same, then the corresponding bit in the
 // result is set to 1. Otherwise, it is 0.
-void xor_vx_vy(uint8_t x, uint8_t y) {
-  logger("XOR V%X, V%X\n", x, y);
-  registers[x] ^= registers[y];
-  PC += 2;
+void xor_vx_vy(struct machine *m, uint8_t x, uint8_t y) {
+  m->registers[x] ^= m->registers[y];
+  m->PC += 2;
 }
 
 // 8xy4 - ADD Vx, Vy
@@ -257,134 +457,119 @@ void xor_vx_vy(uint8_t x, uint8_t y) {
 // The values of Vx and Vy are added together. If the result is greater than 8
 // bits (i.e., > 255,) VF is set to 1, otherwise 0. Only the lowest 8 bits of the
 // result are kept, and stored in Vx.
-void add_vx_vy(uint8_t x, uint8_t y) {
-  logger("ADD V%X, V%X\n", x, y);
-
-  if (registers[x] > (255 - registers[y])) {
-    registers[VF] = 1;
+void add_vx_vy(struct machine *m, uint8_t x, uint8_t y) {
+  if (m->registers[x] > (255 - m->registers[y])) {
+    m->registers[VF] = 1;
   } else {
-    registers[VF] = 0;
+    m->registers[VF] = 0;
   }
 
   // Store result in Vx
-  registers[x] = registers[x] + registers[y];
+  m->registers[x] = m->registers[x] + m->registers[y];
 
-  PC += 2;
+  m->PC += 2;
 }
 
 // 8xy5 - SUB Vx, Vy
 // Set Vx = Vx - Vy, set VF = NOT borrow.
 // If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx,
 // and the results stored in Vx.
-void sub_vx_vy(uint8_t x, uint8_t y) {
-  logger("SUB V%X, V%X\n", x, y);
-
-  if (registers[x] > registers[y]) {
-    registers[VF] = 1;
+void sub_vx_vy(struct machine *m, uint8_t x, uint8_t y) {
+  if (m->registers[x] > m->registers[y]) {
+    m->registers[VF] = 1;
   } else {
-    registers[VF] = 0;
+    m->registers[VF] = 0;
   }
 
-  registers[x] = registers[x] - registers[y];
+  m->registers[x] = m->registers[x] - m->registers[y];
 
-  PC += 2;
+  m->PC += 2;
 }
 
 // 8xy6 - SHR Vx {, Vy}
 // Set Vx = Vx SHR 1.
 // If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0.
 // Then Vx is divided by 2.
-void shr_vx_vy(uint8_t x, uint8_t y) {
-  logger("SHR V%X {, V%X}\n", x, y);
-
-  if ((registers[x] & 0x1) == 1) {
-    registers[VF] = 1;
+void shr_vx_vy(struct machine *m, uint8_t x, uint8_t y) {
+  if ((m->registers[x] & 0x1) == 1) {
+    m->registers[VF] = 1;
   } else {
-    registers[VF] = 0;
+    m->registers[VF] = 0;
   }
 
-  registers[x] /= 2;
+  m->registers[x] /= 2;
 
-  PC += 2;
+  m->PC += 2;
 }
 
 // 8xy7 - SUBN Vx, Vy
 // Set Vx = Vy - Vx, set VF = NOT borrow.
 // If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy,
 // and the results stored in Vx.
-void subn_vx_vy(uint8_t x, uint8_t y) {
-  logger("SUBN V%X, V%X\n", x, y);
-
-  if (registers[y] > registers[x]) {
-    registers[VF] = 1;
+void subn_vx_vy(struct machine *m, uint8_t x, uint8_t y) {
+  if (m->registers[y] > m->registers[x]) {
+    m->registers[VF] = 1;
   } else {
-    registers[VF] = 0;
+    m->registers[VF] = 0;
   }
 
-  registers[x] -= registers[y];
+  m->registers[x] -= m->registers[y];
 
-  PC += 2;
+  m->PC += 2;
 }
 
 // 8xyE - SHL Vx {, Vy}
 // Set Vx = Vx SHL 1.
 // If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0.
 // Then Vx is multiplied by 2.
-void shl_vx_vy(uint8_t x, uint8_t y) {
-  logger("SHL V%X {, V%X}\n", x, y);
-
-  if ((0b10000000 & registers[x]) == 1) {
-    registers[VF] = 1;
+void shl_vx_vy(struct machine *m, uint8_t x, uint8_t y) {
+  if ((0b10000000 & m->registers[x]) == 1) {
+    m->registers[VF] = 1;
   } else {
-    registers[VF] = 0;
+    m->registers[VF] = 0;
   }
 
-  registers[x] *= 2;
+  m->registers[x] *= 2;
 
-  PC += 2;
+  m->PC += 2;
 }
 
 // 9xy0 - SNE Vx, Vy
 // Skip next instruction if Vx != Vy.
 // The values of Vx and Vy are compared, and if they are not equal, the program
 // counter is increased by 2.
-void sne_vx_vy(uint8_t x, uint8_t y) {
-  logger("SNE V%X, V%X\n", x, y);
-
-  if (registers[x] != registers[y]) {
-    PC += 2;
+void sne_vx_vy(struct machine *m, uint8_t x, uint8_t y) {
+  if (m->registers[x] != m->registers[y]) {
+    skip_next(m);
+  } else {
+    m->PC += 2;
   }
-
-  PC += 2;
 }
 
 // Annn - LD I, addr
 // Set I = nnn.
 // The value of register I is set to nnn.
-void ld_i_nnn(uint16_t nnn) {
-  logger("LD I, 0x%X\n", nnn);
-  I = nnn;
-  PC += 2;
+void ld_i_nnn(struct machine *m, uint16_t nnn) {
+  m->I = nnn;
+  m->PC += 2;
 }
 
 // Bnnn - JP V0, addr
 // Jump to location nnn + V0.
-void jp_v0_nnn(uint16_t nnn) {
-  logger("JP V0, 0x%X\n", nnn);
+void jp_v0_nnn(struct machine *m, uint16_t nnn) {
   // The program counter is set to nnn plus the value of V0.
-  PC = registers[V0] + nnn;
+  m->PC = m->registers[V0] + nnn;
 }
 
 // Cxkk - RND Vx, byte
 // Set Vx = random byte AND kk.
 // The interpreter generates a random number from 0 to 255,
 // which is then ANDed with the value kk. The results are stored in Vx.
-void rnd_vx_yy(uint8_t x, uint8_t yy) {
-  logger("RND V%X, %X\n", x, yy);
+void rnd_vx_yy(struct machine *m, uint8_t x, uint8_t yy) {
+  m->registers[x] = next_random(m) & yy;
+  m->dirty = DIRTY_ALL;
 
-  registers[x] = (rand() % 255) & yy;
-
-  PC += 2;
+  m->PC += 2;
 }
 
 // Dxyn - DRW Vx, Vy, nibble
@@ -397,49 +582,72 @@ void rnd_vx_yy(uint8_t x, uint8_t yy) {
 // the opposite side of the screen. See instruction 8xy3 for more information
 // on XOR, and section 2.4, Display, for more information on the Chip-8 screen
 // and sprites.
-void drw_vx_vy(uint8_t x, uint8_t y, uint8_t n) {
-  logger("DRW V%X, V%X, 0x%X\n", x, y, n);
-
-  uint8_t x_val = get_vreg(x);
-  uint8_t y_val = get_vreg(y);
-  uint8_t pixel = 0;
+//
+// SUPER-CHIP and XO-CHIP extend this: with n = 0 a 16x16 sprite of 32 bytes is
+// drawn, and each selected XO-CHIP plane takes its own copy of the sprite data
+// one after the other.
+void drw_vx_vy(struct machine *m, uint8_t x, uint8_t y, uint8_t n) {
+  int width = gfx_width(m);
+  int height = gfx_height(m);
+  int x_val = get_vreg(m, x) & (width - 1);
+  int y_val = get_vreg(m, y) & (height - 1);
+
+  // Dxy0 draws 16 pixels wide by 16 lines
+  int wide = n == 0;
+  int lines = wide ? 16 : n;
+  uint16_t addr = m->I;
 
   // Zero out the carry/collision flag
-  registers[VF] = 0;
-
-  // Lines
-  for (int yline = 0; yline < n; yline++) {
-    pixel = memory[I + yline];
-    // Each sprite is only 8 bits long
-    for (int xline = 0; xline < 8; xline++) {
-      // Run through each pixel at a time to check it's on/off
-      if ((pixel & (0b10000000 >> xline)) != 0) {
-        // If the current pixel is set... we need to turn on the collision flag
-        if (gfx[x_val + xline + ((y_val + yline) * 64) % (64 * 32)] == 1) {
-          registers[VF] = 1;
+  m->registers[VF] = 0;
+
+  for (int p = 0; p < GFX_PLANES; p++) {
+    if (!(m->planes & (1 << p))) {
+      continue;
+    }
+
+    // Lines
+    for (int yline = 0; yline < lines; yline++) {
+      // Line the sprite up with the left of the row and rotate it across, so
+      // anything off the right edge wraps around
+      uint64_t bits = m->memory[addr++ & MEMORY_MASK];
+      if (wide) {
+        bits = bits << 8 | m->memory[addr++ & MEMORY_MASK];
+      }
+      uint64_t sprite[GFX_WORDS] = { bits << (wide ? 48 : 56), 0 };
+      rotate_row(sprite, width, x_val);
+
+      uint64_t *row = m->gfx[p][(y_val + yline) & (height - 1)];
+
+      // If any of the set pixels are already on we need to turn on the
+      // collision flag
+      for (int w = 0; w < width / 64; w++) {
+        if (row[w] & sprite[w]) {
+          m->registers[VF] = 1;
         }
+
         // Update the graphics buffer
-        gfx[x_val + xline + ((y_val + yline) * 64) % (64 * 32)] ^= 1;
+        row[w] ^= sprite[w];
       }
     }
   }
 
   // toggle the draw flag in the loop
-  drawFlag = 1;
-  PC += 2;
+  m->drawFlag = 1;
+  m->dirty = DIRTY_ALL;
+  m->draws++;
+  m->PC += 2;
 }
 
 // Ex9E - SKP Vx
 // Skip next instruction if key with the value of Vx is pressed.
 // Checks the keyboard, and if the key corresponding to the value of
 // Vx is currently in the down position, PC is increased by 2.
-void skp_vx(uint8_t x) {
-  logger("SKP V%X\n", x);
-
-  if (key[registers[x]] == 1) {
-    PC += 4;
+void skp_vx(struct machine *m, uint8_t x) {
+  m->dirty |= DIRTY_FRAME;
+  if (m->key[m->registers[x]] == 1) {
+    skip_next(m);
   } else {
-    PC += 2;
+    m->PC += 2;
   }
 }
 
@@ -447,70 +655,114 @@ void skp_vx(uint8_t x) {
 // Skip next instruction if key with the value of Vx is not pressed.
 // Checks the keyboard, and if the key corresponding to the value of
 // Vx is currently in the up position, PC is increased by 2.
-void sknp_vx(uint8_t x) {
-  logger("SKNP V%X val: %d\n", x, registers[x]);
-
-  if (key[registers[x]] != 1) {
-    PC += 4;
+void sknp_vx(struct machine *m, uint8_t x) {
+  m->dirty |= DIRTY_FRAME;
+  if (m->key[m->registers[x]] != 1) {
+    skip_next(m);
   } else {
-    PC += 2;
+    m->PC += 2;
+  }
+}
+
+// F000 nnnn - LD I, long nnnn
+// Set I = nnnn, the 16-bit address in the following two bytes (XO-CHIP).
+void ld_i_long(struct machine *m) {
+  m->I = m->memory[(m->PC + 2) & MEMORY_MASK] << 8 |
+         m->memory[(m->PC + 3) & MEMORY_MASK];
+  m->PC += 4;
+}
+
+// Fn01 - PLANE n
+// Select the bitplanes that drawing, scrolling and clearing act on (XO-CHIP).
+void plane(struct machine *m, uint8_t n) {
+  m->planes = n & ((1 << GFX_PLANES) - 1);
+  m->PC += 2;
+}
+
+// F002 - AUDIO
+// Load the 16-byte audio pattern buffer from memory at I (XO-CHIP).
+void audio(struct machine *m) {
+  for (int i = 0; i < 16; i++) {
+    m->pattern[i] = m->memory[(m->I + i) & MEMORY_MASK];
   }
+  m->PC += 2;
 }
 
 // Fx07 - LD Vx, DT
 // Set Vx = delay timer value.
 // The value of DT is placed into Vx.
-void ld_vx_dt(uint8_t x) {
-  logger("LD V%X, DT\n", x);
-  registers[x] = delay_timer;
-  PC += 2;
+void ld_vx_dt(struct machine *m, uint8_t x) {
+  // Nothing but the delay timer can get us out of a loop that comes back
+  // round to the same read with the same registers and no side effects in
+  // between, so there's no point running it again until the timer ticks
+  if (!(m->dirty & DIRTY_IDLE) && m->idle.PC == m->PC && m->idle.I == m->I &&
+      m->idle.SP == m->SP &&
+      !memcmp(m->idle.registers, m->registers, sizeof(m->registers))) {
+    m->status = MACHINE_IDLE;
+  } else {
+    memcpy(m->idle.registers, m->registers, sizeof(m->registers));
+    m->idle.I = m->I;
+    m->idle.PC = m->PC;
+    m->idle.SP = m->SP;
+    m->dirty &= ~DIRTY_IDLE;
+  }
+
+  m->registers[x] = m->delay_timer;
+  m->PC += 2;
 }
 
 // Fx0A - LD Vx, K
 // Wait for a key press, store the value of the key in Vx.
 // All execution stops until a key is pressed, then the value of
 // that key is stored in Vx.
-void ld_vx_k(uint8_t x) {
-  logger("LD V%X, K\n", x);
-
+void ld_vx_k(struct machine *m, uint8_t x) {
   // Spin over the keys, check if there's one that has been pressed
   // If so, increment the program counter and move on
+  m->dirty |= DIRTY_FRAME;
 
   for (int i = 0; i < 16; i++) {
-    if (key[i] == 1) {
-      registers[x] = key[i];
-      PC += 2;
-      break;
+    if (m->key[i] == 1) {
+      m->registers[x] = i;
+      m->PC += 2;
+      m->status = MACHINE_RUNNING;
+      return;
     }
   }
 
+  m->status = MACHINE_WAIT_KEY;
 }
 
 // Fx15 - LD DT, Vx
 // Set delay timer = Vx.
 // DT is set equal to the value of Vx.
-void ld_dt_vx(uint8_t x) {
-  logger("LD DT, V%X\n", x);
-  delay_timer = registers[x];
-  PC += 2;
+void ld_dt_vx(struct machine *m, uint8_t x) {
+  m->delay_timer = m->registers[x];
+  m->dirty = DIRTY_ALL;
+  m->PC += 2;
 }
 
 // Fx18 - LD ST, Vx
 // Set sound timer = Vx.
 // ST is set equal to the value of Vx.
-void ld_st_vx(uint8_t x) {
-  logger("LD ST, V%X\n", x);
-  sound_timer = registers[x];
-  PC += 2;
+void ld_st_vx(struct machine *m, uint8_t x) {
+  m->sound_timer = m->registers[x];
+  m->dirty = DIRTY_ALL;
+  m->PC += 2;
+}
+
+// Fx3A - PITCH Vx
+// Set the audio pattern playback pitch = Vx (XO-CHIP).
+void pitch(struct machine *m, uint8_t x) {
+  m->pitch = m->registers[x];
+  m->PC += 2;
 }
 
 // Fx1E - ADD I, Vx
 // Set I = I + Vx.
 // The values of I and Vx are added, and the results are stored in I.
-void add_i_vx(uint8_t x) {
-  logger("ADD I, V%X\n", x);
-  I += registers[x];
-  PC += 2;
+void add_i_vx(struct machine *m, uint8_t x) {
+  m->I += m->registers[x];
+  m->PC += 2;
 }
 
 // Fx29 - LD F, Vx
@@ -518,19 +770,16 @@ void add_i_vx(uint8_t x) {
 // The value of I is set to the location for the hexadecimal sprite corresponding
 // to the value of Vx. See section 2.4, Display, for more information on the
 // Chip-8 hexadecimal font.
-void ld_f_vx(uint8_t x) {
-  logger("LD F, V%X\n", x);
-  // logger("Loading sprite %d\n", registers[x] * 5);
-  I = registers[x] * 5;
-  PC += 2;
+void ld_f_vx(struct machine *m, uint8_t x) {
+  m->I = m->registers[x] * 5;
+  m->PC += 2;
 }
 
-// Super 8 chip instruction
-// LD HF, Vx
-void ld_hf_vx(uint8_t x) {
-  logger("LD HF, V%X - 0x%X\n", x, registers[x]);
-  I = registers[x] * 10;
-  PC += 2;
+// Fx30 - LD HF, Vx
+// Set I = location of the 8x10 sprite for digit Vx (SUPER-CHIP).
+void ld_hf_vx(struct machine *m, uint8_t x) {
+  m->I = BIG_FONT_START + (m->registers[x] & 0xF) * 10;
+  m->PC += 2;
 }
 
 // Fx33 - LD B, Vx
@@ -538,279 +787,502 @@ void ld_hf_vx(uint8_t x) {
 // The interpreter takes the decimal value of Vx, and places the hundreds
 // digit in memory at location in I, the tens digit at location I+1, and the
 // ones digit at location I+2.
-void ld_b_vx(uint8_t x) {
-  logger("LD B, V%X\n", x);
-
+void ld_b_vx(struct machine *m, uint8_t x) {
   // Store BCD representation of Vx in memory locations I, I+1, and I+2.
-  uint8_t current_val = get_vreg(x);
+  uint8_t current_val = get_vreg(m, x);
 
   // Store the representation in memory
-  memory[I] = current_val / 100;
-  memory[I + 1] = current_val / 10 % 10;
-  memory[I + 2] = current_val % 10;
+  m->memory[m->I & MEMORY_MASK] = current_val / 100;
+  m->memory[(m->I + 1) & MEMORY_MASK] = current_val / 10 % 10;
+  m->memory[(m->I + 2) & MEMORY_MASK] = current_val % 10;
+  touch_memory(m, m->I + 3);
+  m->dirty = DIRTY_ALL;
 
-  PC += 2;
+  m->PC += 2;
 }
 
 // Fx55 - LD [I], Vx
 // Store registers V0 through Vx in memory starting at location I.
 // The interpreter copies the values of registers V0 through Vx into memory,
 // starting at the address in I.
-void ld_i_vx(uint8_t x) {
-  logger("LD [I], V%X\n", x);
-
+void ld_i_vx(struct machine *m, uint8_t x) {
   for (int i = 0; i <= x; i++) {
-    memory[I + i] = registers[i];
+    m->memory[(m->I + i) & MEMORY_MASK] = m->registers[i];
   }
+  touch_memory(m, m->I + x + 1);
+  m->dirty = DIRTY_ALL;
 
-  PC += 2;
+  m->PC += 2;
 }
 
 // Fx65 - LD Vx, [I]
 // The interpreter reads values from memory starting at location I
 // into registers V0 through Vx.
-void ld_vx_i(uint8_t x) {
-  logger("LD V%X, [I]\n", x);
-
+void ld_vx_i(struct machine *m, uint8_t x) {
   for (int i = 0; i <= x; i++) {
-    registers[i] = memory[I + i];
+    m->registers[i] = m->memory[(m->I + i) & MEMORY_MASK];
   }
 
-  PC += 2;
+  m->PC += 2;
 }
 
-// Initializes all values where needed for the architecture.
-void initialize(uint8_t *game, size_t game_size) {
+// Fx75 - LD R, Vx
+// Store registers V0 through Vx in the flag registers (SUPER-CHIP).
+void ld_r_vx(struct machine *m, uint8_t x) {
+  memcpy(m->flags, m->registers, x + 1);
+  m->dirty = DIRTY_ALL;
+  m->PC += 2;
+}
 
-  // Load fontset
-  for (int i = 0; i < 80; i++) {
-    memory[i] = chip8_fontset[i];
+// Fx85 - LD Vx, R
+// Read registers V0 through Vx from the flag registers (SUPER-CHIP).
+void ld_vx_r(struct machine *m, uint8_t x) {
+  memcpy(m->registers, m->flags, x + 1);
+  m->PC += 2;
+}
+
+// Zeroes a machine
+// Memory is only cleared as far up as anything has been written, so a reset
+// doesn't touch pages the ROM never used. The machine must have started out
+// zeroed, as statics and machines from the pool do.
+void clear_machine(struct machine *m) {
+  uint32_t top = m->mem_top > MEMORY_SIZE ? MEMORY_SIZE : m->mem_top;
+  memset(m, 0, offsetof(struct machine, memory));
+  memset(m->memory, 0, top);
+}
+
+// Puts the registers, stack, timers and display back how a ROM of game_size
+// bytes starts, leaving memory alone
+// Keys follow the real keyboard, so they survive a reset.
+static void reset_state(struct machine *m, size_t game_size) {
+  uint8_t key[16];
+  memcpy(key, m->key, sizeof(key));
+  memset(m, 0, offsetof(struct machine, memory));
+  memcpy(m->key, key, sizeof(key));
+
+  // Draw to the first plane, the only one plain CHIP-8 knows about
+  m->planes = 1;
+
+  // Program counter starts at 0x200
+  m->PC = ROM_START;
+
+  m->status = MACHINE_RUNNING;
+  m->idle.PC = IDLE_NONE;
+  m->dirty = DIRTY_ALL;
+
+  // Make sure the cleared screen gets drawn
+  m->drawFlag = 1;
+
+  seed_random(m, RANDOM_SEED);
+
+  m->mem_top = ROM_START + game_size;
+}
+
+// Initializes all values where needed for the architecture.
+// Safe to call on a machine that's already running to restart it or swap in
+// another ROM, everything but the keys is wiped first.
+// Returns -1 if the ROM didn't fit, only as much as fits is loaded.
+int initialize(struct machine *m, const uint8_t *game, size_t game_size) {
+  int fits = game_size <= ROM_MAX;
+  if (!fits) {
+    game_size = ROM_MAX;
   }
 
-  // Reset timers
-  delay_timer = 0;
-  sound_timer = 0;
+  // Clear memory
+  uint32_t top = m->mem_top > MEMORY_SIZE ? MEMORY_SIZE : m->mem_top;
+  memset(m->memory, 0, top);
 
-  logger("Loading ROM...\n");
+  // Load fontsets
+  memcpy(&m->memory[FONT_START], chip8_fontset, sizeof(chip8_fontset));
+  memcpy(&m->memory[BIG_FONT_START], chip8_big_fontset, sizeof(chip8_big_fontset));
 
-  // Load the ROM file
-  int bufferSize = 2048;
-  uint8_t buffer[bufferSize];
-  memcpy(buffer, game, game_size);
+  // Load ROM straight into memory
+  logger("Loading ROM into memory...\n");
+  memcpy(&m->memory[ROM_START], game, game_size);
   logger("Read %zu\n", game_size);
 
-  // Load ROM into memory
-  logger("Loading ROM into memory...\n");
-  for (int i = 0; i < bufferSize; i++) {
-    memory[512 + i] = buffer[i];
-  }
+  reset_state(m, game_size);
+
+  return fits ? 0 : -1;
+}
+
+// Initializes a machine whose memory already holds the fontsets and a ROM of
+// game_size bytes, exactly as initialize would leave it, without writing to
+// memory at all
+// Returns -1 if the ROM couldn't have fitted.
+int initialize_loaded(struct machine *m, size_t game_size) {
+  int fits = game_size <= ROM_MAX;
+  reset_state(m, fits ? game_size : ROM_MAX);
+  return fits ? 0 : -1;
 }
 
-void update_timers() {
+void update_timers(struct machine *m) {
   // Update timers
-  if (delay_timer > 0) {
-    --delay_timer;
+  if (m->delay_timer > 0) {
+    --m->delay_timer;
+  }
+
+  if (m->sound_timer > 0) {
+    if (m->sound_timer == 1) {
+      logger("****** BEEP! ******\n");
+    }
+    --m->sound_timer;
+  }
+}
+
+// FNV-1a over everything a machine's next instruction can depend on that
+// doesn't mark it dirty when it changes
+// Memory, the display and the keys are left out, changing or reading them
+// dirties the frame. The sound timer is too, nothing reads it.
+static uint64_t fingerprint(const struct machine *m) {
+  uint8_t state[16 + 2 + 2 + 1 + 1 + 1 + 1 + sizeof(m->stack)];
+  memcpy(state, m->registers, 16);
+  memcpy(state + 16, &m->I, 2);
+  memcpy(state + 18, &m->PC, 2);
+  state[20] = m->SP;
+  state[21] = m->delay_timer;
+  state[22] = m->hires;
+  state[23] = m->planes;
+
+  // Only the stack up to SP is ever read again before it's written
+  size_t depth = ((m->SP & 0xF) + 1) * sizeof(m->stack[0]);
+  memcpy(state + 24, m->stack, depth);
+
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < 24 + depth; i++) {
+    hash = (hash ^ state[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// Ticks the timers at the end of a frame, and checks whether the machine has
+// got stuck
+// Once frames have gone by without dirtying anything, a machine that comes
+// back round to a state it was in at the end of one of them will go round
+// the same way forever, so it's stopped rather than left to burn a core.
+void end_frame(struct machine *m) {
+  update_timers(m);
+  if (machine_stopped(m->status)) {
+    return;
   }
 
-  if (sound_timer > 0) {
-    if (sound_timer == 1) {
-      printf("****** BEEP! ******\n");
+  uint64_t print = fingerprint(m);
+  if (m->dirty & DIRTY_FRAME) {
+    m->dirty &= ~DIRTY_FRAME;
+    m->clean_frames = 0;
+  } else {
+    m->clean_frames++;
+    uint32_t window = m->clean_frames < STUCK_WINDOW ? m->clean_frames : STUCK_WINDOW;
+    for (uint32_t i = 1; i <= window; i++) {
+      if (m->recent[(m->clean_frames - i) % STUCK_WINDOW] == print) {
+        m->status = MACHINE_STUCK;
+        return;
+      }
     }
-    --sound_timer;
   }
+  m->recent[m->clean_frames % STUCK_WINDOW] = print;
 }
 
 // Emulates the actual CPU clock cycle.
-void emulate_cycle() {
+// Returns the machine's status afterwards, see enum machine_status.
+int emulate_cycle(struct machine *m) {
 
   // Fetch opcode
-  opcode = memory[PC] << 8 | memory[PC + 1];
-
-  logger("0x%X - OC: 0x%X - ", PC, opcode);
+  m->opcode = m->memory[m->PC & MEMORY_MASK] << 8 |
+              m->memory[(m->PC + 1) & MEMORY_MASK];
+
+#ifndef DIP_FREESTANDING
+  if (trace) {
+    char text[32];
+    disassemble(m->opcode, m->memory[(m->PC + 2) & MEMORY_MASK] << 8 |
+        m->memory[(m->PC + 3) & MEMORY_MASK], text, sizeof(text));
+    logger("0x%X - OC: 0x%X - %s\n", m->PC, m->opcode, text);
+  }
+#endif
 
   // Decode opcode
-  switch(opcode & 0xF000) {
+  switch(m->opcode & 0xF000) {
 
     case 0x00:
-      switch(opcode & 0x00ff) {
+      switch(m->opcode & 0x00ff) {
         case 0x00: // SYS addr
-          sys(opcode & 0x0fff);
+          sys(m, m->opcode & 0x0fff);
           break;
 
         case 0xE0: // CLS
-          cls();
+          cls(m);
           break;
 
         case 0xEE: // RET
-          ret();
+          ret(m);
+          break;
+
+        case 0xFB: // SCR
+          scr(m);
+          break;
+
+        case 0xFC: // SCL
+          scl(m);
+          break;
+
+        case 0xFD: // EXIT
+          exit_interpreter(m);
+          break;
+
+        case 0xFE: // LOW
+          set_resolution(m, 0);
+          break;
+
+        case 0xFF: // HIGH
+          set_resolution(m, 1);
           break;
 
         default:
-          logger("Unknown opcode: in 0x0: 0x%X\n", opcode);
-          exit(EXIT_FAILURE);
+          if ((m->opcode & 0xfff0) == 0x00C0) { // SCD nibble
+            scd(m, m->opcode & 0x000f);
+          } else if ((m->opcode & 0xfff0) == 0x00D0) { // SCU nibble
+            scu(m, m->opcode & 0x000f);
+          } else {
+            logger("Unknown opcode: in 0x0: 0x%X\n", m->opcode);
+            m->status = MACHINE_FAULT;
+          }
           break;
       }
       break;
 
     case 0x1000: // JP addr
-      jp(opcode & 0x0fff);
+      jp(m, m->opcode & 0x0fff);
       break;
 
     case 0x2000: // CALL addr
-      call_nnn(opcode & 0x0fff);
+      call_nnn(m, m->opcode & 0x0fff);
       break;
 
     case 0x3000: // SE Vx, byte
-      se_vx_yy((opcode & 0x0f00) >> 8, opcode & 0x00ff);
+      se_vx_yy(m, (m->opcode & 0x0f00) >> 8, m->opcode & 0x00ff);
       break;
 
     case 0x4000: // SNE Vx, byte
-      sne_vx_yy((opcode & 0x0f00) >> 8, opcode & 0x00ff);
+      sne_vx_yy(m, (m->opcode & 0x0f00) >> 8, m->opcode & 0x00ff);
       break;
 
-    case 0x5000: // SE Vx, Vy
-      se_vx_vy((opcode & 0x0f00) >> 8, (opcode & 0x00f0) >> 4);
+    case 0x5000:
+      switch(m->opcode & 0x000f) {
+        case 0x0: // SE Vx, Vy
+          se_vx_vy(m, (m->opcode & 0x0f00) >> 8, (m->opcode & 0x00f0) >> 4);
+          break;
+
+        case 0x2: // LD [I], Vx-Vy - XO-CHIP instruction
+          save_vx_vy(m, (m->opcode & 0x0f00) >> 8, (m->opcode & 0x00f0) >> 4);
+          break;
+
+        case 0x3: // LD Vx-Vy, [I] - XO-CHIP instruction
+          load_vx_vy(m, (m->opcode & 0x0f00) >> 8, (m->opcode & 0x00f0) >> 4);
+          break;
+
+        default:
+          logger("Unknown opcode: in 0x5: 0x%X\n", m->opcode);
+          m->status = MACHINE_FAULT;
+          break;
+      }
       break;
 
     case 0x6000: // LD Vx, byte
-      ld_vx_yy((opcode & 0x0f00) >> 8, opcode & 0x00ff);
+      ld_vx_yy(m, (m->opcode & 0x0f00) >> 8, m->opcode & 0x00ff);
       break;
 
     case 0x7000: // ADD Vx, byte
-      add_vx_yy((opcode & 0x0f00) >> 8, opcode & 0x00ff);
+      add_vx_yy(m, (m->opcode & 0x0f00) >> 8, m->opcode & 0x00ff);
       break;
 
     case 0x8000:
-      switch(opcode & 0xf) {
+      switch(m->opcode & 0xf) {
         case 0x0: // LD Vx, Vy
-          ld_vx_vy((opcode & 0x0f00) >> 8, (opcode & 0x00f0) >> 4);
+          ld_vx_vy(m, (m->opcode & 0x0f00) >> 8, (m->opcode & 0x00f0) >> 4);
           break;
 
         case 0x1: // OR Vx, Vy
-          or_vx_vy((opcode & 0x0f00) >> 8, (opcode & 0x00f0) >> 4);
+          or_vx_vy(m, (m->opcode & 0x0f00) >> 8, (m->opcode & 0x00f0) >> 4);
           break;
 
         case 0x2: // AND Vx, Vy
-          and_vx_vy((opcode & 0x0f00) >> 8, (opcode & 0x00f0) >> 4);
+          and_vx_vy(m, (m->opcode & 0x0f00) >> 8, (m->opcode & 0x00f0) >> 4);
           break;
 
         case 0x3: // XOR Vx, Vy
-          xor_vx_vy((opcode & 0x0f00) >> 8, (opcode & 0x00f0) >> 4);
+          xor_vx_vy(m, (m->opcode & 0x0f00) >> 8, (m->opcode & 0x00f0) >> 4);
           break;
 
         case 0x4: // ADD Vx, Vy
-          add_vx_vy((opcode & 0x0f00) >> 8, (opcode & 0x00f0) >> 4);
+          add_vx_vy(m, (m->opcode & 0x0f00) >> 8, (m->opcode & 0x00f0) >> 4);
           break;
 
         case 0x5: // SUB Vx, Vy
-          sub_vx_vy((opcode & 0x0f00) >> 8, (opcode & 0x00f0) >> 4);
+          sub_vx_vy(m, (m->opcode & 0x0f00) >> 8, (m->opcode & 0x00f0) >> 4);
           break;
 
         case 0x6: // SHR Vx {, Vy}
-          shr_vx_vy((opcode & 0x0f00) >> 8, (opcode & 0x00f0) >> 4);
+          shr_vx_vy(m, (m->opcode & 0x0f00) >> 8, (m->opcode & 0x00f0) >> 4);
           break;
 
         case 0x7: // SUBN Vx, Vy
-          subn_vx_vy((opcode & 0x0f00) >> 8, (opcode & 0x00f0) >> 4);
+          subn_vx_vy(m, (m->opcode & 0x0f00) >> 8, (m->opcode & 0x00f0) >> 4);
           break;
 
         case 0xE: // SHL Vx {, Vy}
-          shl_vx_vy((opcode & 0x0f00) >> 8, (opcode & 0x00f0) >> 4);
+          shl_vx_vy(m, (m->opcode & 0x0f00) >> 8, (m->opcode & 0x00f0) >> 4);
           break;
 
         default:
-          logger("Unknown opcode: in 0x8: 0x%X\n", opcode);
-          exit(EXIT_FAILURE);
+          logger("Unknown opcode: in 0x8: 0x%X\n", m->opcode);
+          m->status = MACHINE_FAULT;
           break;
 
       }
       break;
 
     case 0x9000: // SNE Vx, Vy
-      sne_vx_vy((opcode & 0x0f00) >> 8, (opcode & 0x00f0) >> 4);
+      sne_vx_vy(m, (m->opcode & 0x0f00) >> 8, (m->opcode & 0x00f0) >> 4);
       break;
 
     case 0xA000: // LD I, addr
-      ld_i_nnn(opcode & 0x0fff);
+      ld_i_nnn(m, m->opcode & 0x0fff);
       break;
 
     case 0xB000: // JP V0, addr
-      jp_v0_nnn(opcode & 0x0fff);
+      jp_v0_nnn(m, m->opcode & 0x0fff);
       break;
 
     case 0xC000: // RND Vx, byte
-      rnd_vx_yy((opcode & 0x0f00) >> 8, opcode & 0x00ff);
+      rnd_vx_yy(m, (m->opcode & 0x0f00) >> 8, m->opcode & 0x00ff);
       break;
 
     case 0xD000: // DRW Vx, Vy, nibble
-      drw_vx_vy((opcode & 0xf00) >> 8, (opcode & 0x00f0) >> 4, opcode & 0x000f);
+      drw_vx_vy(m, (m->opcode & 0xf00) >> 8, (m->opcode & 0x00f0) >> 4, m->opcode & 0x000f);
       break;
 
     case 0xE000:
-      switch(opcode & 0x00ff) {
+      switch(m->opcode & 0x00ff) {
         case 0x9E: //  SKP Vx
-          skp_vx((opcode & 0xf00) >> 8);
+          skp_vx(m, (m->opcode & 0xf00) >> 8);
           break;
 
         case 0xA1: // SKNP Vx
-          sknp_vx((opcode & 0xf00) >> 8);
+          sknp_vx(m, (m->opcode & 0xf00) >> 8);
+          break;
+
+        default:
+          logger("Unknown opcode: in 0xE: 0x%X\n", m->opcode);
+          m->status = MACHINE_FAULT;
           break;
       }
       break;
 
     case 0xF000:
-      switch(opcode & 0x00ff) {
+      switch(m->opcode & 0x00ff) {
+        case 0x00: // LD I, long - XO-CHIP instruction
+          if (m->opcode != 0xF000) {
+            logger("Unknown opcode: 0x%X\n", m->opcode);
+            m->status = MACHINE_FAULT;
+            break;
+          }
+          ld_i_long(m);
+          break;
+
+        case 0x01: // PLANE n - XO-CHIP instruction
+          plane(m, (m->opcode & 0x0f00) >> 8);
+          break;
+
+        case 0x02: // AUDIO - XO-CHIP instruction
+          audio(m);
+          break;
+
         case 0x07: // LD Vx, DT
-          ld_vx_dt((opcode & 0x0f00) >> 8);
+          ld_vx_dt(m, (m->opcode & 0x0f00) >> 8);
           break;
 
         case 0x0A: // LD Vx, K
-          ld_vx_k((opcode & 0x0f00) >> 8);
+          ld_vx_k(m, (m->opcode & 0x0f00) >> 8);
           break;
 
         case 0x15: // LD DT, Vx
-          ld_dt_vx((opcode & 0x0f00) >> 8);
+          ld_dt_vx(m, (m->opcode & 0x0f00) >> 8);
           break;
 
         case 0x18: // LD ST, Vx
-          ld_st_vx((opcode & 0x0f00) >> 8);
+          ld_st_vx(m, (m->opcode & 0x0f00) >> 8);
           break;
 
         case 0x1E: // ADD I, Vx
-          add_i_vx((opcode & 0x0f00) >> 8);
+          add_i_vx(m, (m->opcode & 0x0f00) >> 8);
           break;
 
         case 0x29: // LD F, Vx
-          ld_f_vx((opcode & 0x0f00) >> 8);
+          ld_f_vx(m, (m->opcode & 0x0f00) >> 8);
           break;
 
         case 0x30: // LD HF, Vx - Super-8 chip instruction
-          ld_hf_vx((opcode & 0x0f00) >> 8);
+          ld_hf_vx(m, (m->opcode & 0x0f00) >> 8);
           break;
 
         case 0x33: // LD B, Vx
-          ld_b_vx((opcode & 0x0f00) >> 8);
+          ld_b_vx(m, (m->opcode & 0x0f00) >> 8);
           break;
 
         case 0x55: // LD [I], Vx
-          ld_i_vx((opcode & 0x0f00) >> 8);
+          ld_i_vx(m, (m->opcode & 0x0f00) >> 8);
           break;
 
         case 0x65: // LD Vx, [I]
-          ld_vx_i((opcode & 0x0f00) >> 8);
+          ld_vx_i(m, (m->opcode & 0x0f00) >> 8);
+          break;
+
+        case 0x3A: // PITCH Vx - XO-CHIP instruction
+          pitch(m, (m->opcode & 0x0f00) >> 8);
+          break;
+
+        case 0x75: // LD R, Vx - Super-8 chip instruction
+          ld_r_vx(m, (m->opcode & 0x0f00) >> 8);
+          break;
+
+        case 0x85: // LD Vx, R - Super-8 chip instruction
+          ld_vx_r(m, (m->opcode & 0x0f00) >> 8);
           break;
 
         default:
-          logger("Unknown opcode: 0x%X\n", opcode);
-          exit(EXIT_FAILURE);
+          logger("Unknown opcode: 0x%X\n", m->opcode);
+          m->status = MACHINE_FAULT;
           break;
       }
       break;
 
     default:
-      logger("Unknown opcode: 0x%X\n", opcode);
-      exit(EXIT_FAILURE);
+      logger("Unknown opcode: 0x%X\n", m->opcode);
+      m->status = MACHINE_FAULT;
       break;
   }
 
+  return m->status;
+}
+
+// Runs a single 60Hz frame of up to cycles instructions then ends it
+// The frame is cut short as soon as the machine blocks on a key, settles into
+// polling the delay timer, or faults, as running on would change nothing.
+int run_frame(struct machine *m, int cycles) {
+  if (machine_stopped(m->status)) {
+    update_timers(m);
+    return m->status;
+  }
+  m->status = MACHINE_RUNNING;
+  m->idle.PC = IDLE_NONE;
+
+  int i;
+  for (i = 0; i < cycles && m->status == MACHINE_RUNNING; i++) {
+    emulate_cycle(m);
+  }
+  m->cycles += i;
+
+  end_frame(m);
+
+  return m->status;
 }
@@ -4,17 +4,66 @@
 #ifndef CPU_H
 #define CPU_H
 
-void initialize();
-void emulate_cycle();
-void update_timers();
+#include <stddef.h>
+#include <stdint.h>
 
-extern uint8_t gfx[64 * 32];
+// Size of a cache line on the hosts we care about
+#define CACHE_LINE 64
 
-extern int drawFlag;
+// CHIP-8 has 4k of main memory, XO-CHIP extends it to 64k
+// Build with -DMEMORY_SIZE=4096 for machines that only need to run CHIP-8
+// and SUPER-CHIP programs. Must be a power of two.
+#ifndef MEMORY_SIZE
+#define MEMORY_SIZE 65536
+#endif
+#define MEMORY_MASK (MEMORY_SIZE - 1)
 
-extern uint8_t sound_timer;
+// Memory starts on a page boundary so a shared ROM image can be mapped over
+// it, see image.h. Embedded builds have no pages and pack machines tighter.
+#ifndef MEMORY_ALIGN
+#ifdef DIP_FREESTANDING
+#define MEMORY_ALIGN CACHE_LINE
+#else
+#define MEMORY_ALIGN 4096
+#endif
+#endif
 
-extern uint8_t key[16];
+// Entries on the call stack, the first is never used so CALLs nest 15 deep
+#define STACK_SIZE 16
+
+// Programs are loaded at 0x200 and may fill the rest of memory
+#define ROM_START 0x200
+#define ROM_MAX (MEMORY_SIZE - ROM_START)
+
+// Screen is 64 * 32 pixels, or 128 * 64 in SUPER-CHIP hi-res mode
+#define GFX_WIDTH 64
+#define GFX_HEIGHT 32
+#define GFX_HI_WIDTH 128
+#define GFX_HI_HEIGHT 64
+
+// Each row is packed into 64-bit words, one in lo-res and two in hi-res
+#define GFX_WORDS (GFX_HI_WIDTH / 64)
+
+// XO-CHIP draws to two bitplanes, which combine into four colours
+#define GFX_PLANES 2
+
+// No idle snapshot has been taken this frame
+#define IDLE_NONE 0xFFFF
+
+// What RND starts from after initialize, unless seed_random says otherwise
+#define RANDOM_SEED 0x2545F491
+
+// Bits of the machine's dirty flag
+#define DIRTY_IDLE 1   // Since the last Fx07 snapshot
+#define DIRTY_FRAME 2  // Since the last end_frame, reading keys counts too
+#define DIRTY_ALL (DIRTY_IDLE | DIRTY_FRAME)
+
+// Frames back end_frame looks for the state repeating
+#define STUCK_WINDOW 16
+
+// Font locations in memory
+#define FONT_START 0x00
+#define BIG_FONT_START 0x50
 
 // Registers
 // CHIP-8 has 16 8-bit registers
@@ -37,4 +86,144 @@ enum registers {
   VF,
 };
 
-#endif // #CPU_H
\ No newline at end of file
+// What a machine is up to after a cycle or frame
+enum machine_status {
+  MACHINE_RUNNING,
+  MACHINE_WAIT_KEY, // Blocked in Fx0A until a key goes down
+  MACHINE_IDLE,     // Spinning on the delay timer until it next ticks
+  MACHINE_FAULT,    // Hit an unknown opcode, or over or underflowed the stack
+  MACHINE_HALTED,   // Exited with SUPER-CHIP 00FD
+  MACHINE_STUCK,    // Jumped to itself, or proven to loop forever doing nothing
+};
+
+// State of a single CHIP-8 machine
+// Everything touched on every cycle lives in the first cache line, the
+// bulkier stack, display and memory follow on behind it.
+struct machine {
+  // Hot state
+  _Alignas(CACHE_LINE) uint8_t registers[16];
+
+  // 16-bit index register
+  uint16_t I;
+
+  // 16-bit program counter
+  uint16_t PC;
+
+  // Current opcode
+  uint16_t opcode;
+
+  // Stack pointer
+  uint8_t SP;
+
+  // CHIP-8 has no interrupts but does have 2 timers
+  uint8_t delay_timer;
+  uint8_t sound_timer;
+
+  // Flag for whether to update the graphics output or not
+  uint8_t drawFlag;
+
+  // One of enum machine_status
+  uint8_t status;
+
+  // SUPER-CHIP 128 * 64 mode, and the XO-CHIP bitplanes being drawn to
+  uint8_t hires;
+  uint8_t planes;
+
+  // Set by anything that changes state outside of the registers, so a loop
+  // polling the delay timer can be proven to be spinning in place, or one
+  // that never gets anywhere proven stuck. See DIRTY_*.
+  uint8_t dirty;
+
+  // Keyboard control
+  // CHIP-8 has total of 16 keys
+  uint8_t key[16];
+
+  // Cold state
+  _Alignas(CACHE_LINE) uint16_t stack[STACK_SIZE];
+
+  // Instructions run by run_frame and sprites drawn, since initialize
+  // Both are bumped off the per-instruction path.
+  uint64_t cycles;
+  uint32_t draws;
+
+  // Snapshot taken at the last Fx07 of the current frame
+  struct {
+    uint8_t registers[16];
+    uint16_t I;
+    uint16_t PC;
+    uint8_t SP;
+  } idle;
+
+  // SUPER-CHIP flag registers saved by Fx75
+  uint8_t flags[16];
+
+  // XO-CHIP audio pattern and pitch
+  uint8_t pattern[16];
+  uint8_t pitch;
+
+  // State of the generator behind RND
+  uint32_t rng;
+
+  // Everything above this address in memory is still zero
+  uint32_t mem_top;
+
+  // Fingerprints of the state at the end of recent frames, and how many
+  // frames in a row have gone by without dirtying anything
+  uint64_t recent[STUCK_WINDOW];
+  uint32_t clean_frames;
+
+  // Graphics
+  // Packed one bit per pixel per plane, each row is GFX_WORDS 64-bit words.
+  // The most significant bit of the first word is the left-most pixel. In
+  // lo-res only the first word of the first 32 rows is used.
+  uint64_t gfx[GFX_PLANES][GFX_HI_HEIGHT][GFX_WORDS];
+
+  // Memory
+  _Alignas(MEMORY_ALIGN) uint8_t memory[MEMORY_SIZE];
+};
+
+_Static_assert(offsetof(struct machine, key) + 16 <= CACHE_LINE,
+    "hot machine state must fit in the first cache line");
+_Static_assert(sizeof(struct machine) % CACHE_LINE == 0,
+    "machines must pack into cache-line-aligned slabs");
+_Static_assert((MEMORY_SIZE & MEMORY_MASK) == 0 && MEMORY_SIZE >= 4096,
+    "memory size must be a power of two of at least 4k");
+
+// Size of the display in the current mode
+static inline int gfx_width(const struct machine *m) {
+  return m->hires ? GFX_HI_WIDTH : GFX_WIDTH;
+}
+
+static inline int gfx_height(const struct machine *m) {
+  return m->hires ? GFX_HI_HEIGHT : GFX_HEIGHT;
+}
+
+// Whether a machine has stopped for good
+static inline int machine_stopped(int status) {
+  return status == MACHINE_FAULT || status == MACHINE_HALTED || status == MACHINE_STUCK;
+}
+
+// Colour of the pixel at (x, y), one bit per plane
+static inline int gfx_pixel(const struct machine *m, int x, int y) {
+  int shift = 63 - (x & 63);
+  return ((m->gfx[0][y][x >> 6] >> shift) & 1) |
+         ((m->gfx[1][y][x >> 6] >> shift) & 1) << 1;
+}
+
+// Traces every instruction to stdout as it runs, on unless turned off
+extern int trace;
+
+// Silences everything the core logs, trace included, for tools whose stdout
+// is their own output
+extern int quiet;
+
+void clear_machine(struct machine *m);
+int initialize(struct machine *m, const uint8_t *game, size_t game_size);
+int initialize_loaded(struct machine *m, size_t game_size);
+void seed_random(struct machine *m, uint32_t seed);
+int emulate_cycle(struct machine *m);
+void update_timers(struct machine *m);
+void end_frame(struct machine *m);
+int run_frame(struct machine *m, int cycles);
+
+#endif // #CPU_H
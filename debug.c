@@ -0,0 +1,319 @@
+//
+// Interactive debugger with breakpoints, watchpoints and stepping
+//
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "debug.h"
+#include "disasm.h"
+
+void debug_init(struct debugger *d) {
+  memset(d, 0, sizeof(*d));
+  d->step_over_sp = -1;
+  d->resume_pc = -1;
+}
+
+// Whether debug_cycle has anything to check, if not emulate_cycle can be run
+// instead
+int debug_needed(const struct debugger *d) {
+  return d->nbreakpoints > 0 || d->nwatches > 0 || d->stepping ||
+      d->step_over_sp >= 0 || d->stopped;
+}
+
+// Stops before the next instruction
+// Whatever was being stepped through is over, even if something else is what
+// stopped it.
+void debug_break(struct debugger *d) {
+  d->stopped = 1;
+  d->stepping = 0;
+  d->step_over_sp = -1;
+}
+
+static int has_breakpoint(const struct debugger *d, uint16_t addr) {
+  return d->breakpoints[addr >> 3] & (1 << (addr & 7));
+}
+
+static uint16_t fetch(const struct machine *m, uint16_t addr) {
+  return m->memory[addr & MEMORY_MASK] << 8 | m->memory[(addr + 1) & MEMORY_MASK];
+}
+
+// Reads the current values of whatever a watchpoint is watching
+static void watch_values(const struct watchpoint *w, const struct machine *m, uint8_t *out) {
+  switch (w->kind) {
+    case WATCH_MEMORY:
+      for (int i = 0; i < w->length; i++) {
+        out[i] = m->memory[(w->addr + i) & MEMORY_MASK];
+      }
+      break;
+
+    case WATCH_REGISTER:
+      out[0] = m->registers[w->addr];
+      break;
+
+    case WATCH_I:
+      out[0] = m->I >> 8;
+      out[1] = m->I;
+      break;
+  }
+}
+
+static void print_watch(int i, const struct watchpoint *w) {
+  switch (w->kind) {
+    case WATCH_MEMORY:
+      printf("  %d: [0x%03X] x %d\n", i, w->addr, w->length);
+      break;
+    case WATCH_REGISTER:
+      printf("  %d: V%X\n", i, w->addr);
+      break;
+    case WATCH_I:
+      printf("  %d: I\n", i);
+      break;
+  }
+}
+
+// Runs a single instruction like emulate_cycle, checking breakpoints before
+// and watchpoints after it
+// Sets stopped when anything is hit, a breakpoint stops before its
+// instruction runs.
+int debug_cycle(struct debugger *d, struct machine *m) {
+  uint16_t pc = m->PC & MEMORY_MASK;
+
+  if (d->nbreakpoints > 0 && pc != d->resume_pc && has_breakpoint(d, pc)) {
+    printf("Breakpoint at 0x%03X\n", pc);
+    debug_break(d);
+    return m->status;
+  }
+  d->resume_pc = -1;
+
+  int status = emulate_cycle(m);
+
+  for (int i = 0; i < d->nwatches; i++) {
+    struct watchpoint *w = &d->watches[i];
+    uint8_t now[16];
+    watch_values(w, m, now);
+    if (memcmp(now, w->seen, w->length)) {
+      printf("Watchpoint %d changed by 0x%03X:\n", i, pc);
+      print_watch(i, w);
+      for (int j = 0; j < w->length; j++) {
+        printf("    0x%02X -> 0x%02X\n", w->seen[j], now[j]);
+      }
+      memcpy(w->seen, now, w->length);
+      debug_break(d);
+    }
+  }
+
+  if (d->stepping || (d->step_over_sp >= 0 && m->SP <= d->step_over_sp)) {
+    debug_break(d);
+  }
+
+  if (machine_stopped(status)) {
+    printf("Machine %s at 0x%03X\n", status == MACHINE_FAULT ? "faulted" :
+        status == MACHINE_HALTED ? "halted" : "stuck", pc);
+    debug_break(d);
+  }
+
+  return status;
+}
+
+// Inspection
+
+static void list(const struct machine *m, uint16_t addr, int count) {
+  for (int i = 0; i < count; i++) {
+    char text[32];
+    uint16_t opcode = fetch(m, addr);
+    size_t len = disassemble(opcode, fetch(m, addr + 2), text, sizeof(text));
+    printf("%c 0x%03X  %04X  %s\n", addr == m->PC ? '>' : ' ', addr, opcode, text);
+    addr = (addr + len) & MEMORY_MASK;
+  }
+}
+
+static void registers(const struct machine *m) {
+  for (int i = 0; i < 16; i++) {
+    printf("V%X=%02X%s", i, m->registers[i], i % 8 == 7 ? "\n" : " ");
+  }
+  printf("I=%03X PC=%03X SP=%X DT=%02X ST=%02X\n", m->I, m->PC, m->SP,
+      m->delay_timer, m->sound_timer);
+}
+
+static void stack(const struct machine *m) {
+  if (m->SP == 0) {
+    printf("Stack is empty\n");
+  }
+  // SP can't get past the stack any more, but never read beyond it anyway
+  int top = m->SP < STACK_SIZE ? m->SP : STACK_SIZE - 1;
+  for (int i = top; i > 0; i--) {
+    printf("  %X: 0x%03X\n", i, m->stack[i]);
+  }
+}
+
+static void dump(const struct machine *m, uint16_t addr, int length) {
+  for (int i = 0; i < length; i++) {
+    if (i % 16 == 0) {
+      printf("%s0x%03X ", i ? "\n" : "", (addr + i) & MEMORY_MASK);
+    }
+    printf(" %02X", m->memory[(addr + i) & MEMORY_MASK]);
+  }
+  printf("\n");
+}
+
+static void help() {
+  printf(
+"  c               Continue\n"
+"  s               Step one instruction\n"
+"  n               Step over a CALL\n"
+"  b [addr]        Set a breakpoint\n"
+"  d [addr]        Delete a breakpoint\n"
+"  w [addr] [len]  Watch memory\n"
+"  w v[x] | w i    Watch a register or I\n"
+"  u [n]           Delete watchpoint n\n"
+"  r               Show registers\n"
+"  k               Show the stack\n"
+"  m [addr] [len]  Dump memory\n"
+"  l [addr] [n]    Disassemble, from the PC by default\n"
+"  t               Toggle instruction tracing\n"
+"  q               Quit\n");
+}
+
+static void add_watch(struct debugger *d, const struct machine *m, const char *arg,
+    const char *len) {
+  if (d->nwatches == DEBUG_WATCHES) {
+    printf("Too many watchpoints\n");
+    return;
+  }
+
+  struct watchpoint w = { .length = 1 };
+  if (tolower((unsigned char)arg[0]) == 'v' && isxdigit((unsigned char)arg[1])) {
+    w.kind = WATCH_REGISTER;
+    w.addr = strtoul(arg + 1, NULL, 16) & 0xF;
+  } else if (tolower((unsigned char)arg[0]) == 'i' && arg[1] == '\0') {
+    w.kind = WATCH_I;
+    w.length = 2;
+  } else {
+    w.kind = WATCH_MEMORY;
+    w.addr = strtoul(arg, NULL, 16) & MEMORY_MASK;
+    if (len != NULL) {
+      w.length = strtoul(len, NULL, 0);
+    }
+    if (w.length < 1 || w.length > sizeof(w.seen)) {
+      printf("Watchpoints cover 1 to %zu bytes\n", sizeof(w.seen));
+      return;
+    }
+  }
+
+  watch_values(&w, m, w.seen);
+  d->watches[d->nwatches] = w;
+  print_watch(d->nwatches, &w);
+  d->nwatches++;
+}
+
+// Takes commands from stdin until told to carry on
+// Returns -1 if the user wants to quit.
+int debug_prompt(struct debugger *d, struct machine *m) {
+  list(m, m->PC, 1);
+
+  char line[128];
+  for (;;) {
+    printf("(dip) ");
+    fflush(stdout);
+    if (fgets(line, sizeof(line), stdin) == NULL) {
+      return -1;
+    }
+
+    char *cmd = strtok(line, " \t\n");
+    char *arg = strtok(NULL, " \t\n");
+    char *arg2 = strtok(NULL, " \t\n");
+    if (cmd == NULL) {
+      continue;
+    }
+
+    uint16_t addr = arg ? strtoul(arg, NULL, 16) & MEMORY_MASK : m->PC;
+
+    switch (cmd[0]) {
+      case 'c':
+      case 's':
+      case 'n': {
+        // Only the command given now decides where to stop next
+        d->stopped = 0;
+        d->stepping = 0;
+        d->step_over_sp = -1;
+        d->resume_pc = m->PC & MEMORY_MASK;
+        const struct mnemonic *mn = find_mnemonic(fetch(m, m->PC));
+        if (cmd[0] == 's' || (cmd[0] == 'n' && (mn == NULL || mn->flow != FLOW_CALL))) {
+          d->stepping = 1;
+        } else if (cmd[0] == 'n') {
+          d->step_over_sp = m->SP;
+        }
+        return 0;
+      }
+
+      case 'b':
+      case 'd':
+        if (arg == NULL) {
+          for (int i = 0; i < MEMORY_SIZE; i++) {
+            if (has_breakpoint(d, i)) {
+              printf("  0x%03X\n", i);
+            }
+          }
+        } else if (cmd[0] == 'b' && !has_breakpoint(d, addr)) {
+          d->breakpoints[addr >> 3] |= 1 << (addr & 7);
+          d->nbreakpoints++;
+        } else if (cmd[0] == 'd' && has_breakpoint(d, addr)) {
+          d->breakpoints[addr >> 3] &= ~(1 << (addr & 7));
+          d->nbreakpoints--;
+        }
+        break;
+
+      case 'w':
+        if (arg == NULL) {
+          for (int i = 0; i < d->nwatches; i++) {
+            print_watch(i, &d->watches[i]);
+          }
+        } else {
+          add_watch(d, m, arg, arg2);
+        }
+        break;
+
+      case 'u':
+        if (arg != NULL) {
+          int i = atoi(arg);
+          if (i >= 0 && i < d->nwatches) {
+            memmove(&d->watches[i], &d->watches[i + 1],
+                (d->nwatches - i - 1) * sizeof(d->watches[0]));
+            d->nwatches--;
+          }
+        }
+        break;
+
+      case 'r':
+        registers(m);
+        break;
+
+      case 'k':
+        stack(m);
+        break;
+
+      case 'm':
+        dump(m, addr, arg2 ? strtoul(arg2, NULL, 0) : 64);
+        break;
+
+      case 'l':
+        list(m, addr, arg2 ? atoi(arg2) : 10);
+        break;
+
+      case 't':
+        trace = !trace;
+        printf("Tracing %s\n", trace ? "on" : "off");
+        break;
+
+      case 'q':
+        return -1;
+
+      default:
+        help();
+        break;
+    }
+  }
+}
@@ -0,0 +1,57 @@
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+#define DEBUG_WATCHES 16
+
+// What a watchpoint keeps an eye on
+enum watch_kind {
+  WATCH_MEMORY,
+  WATCH_REGISTER,
+  WATCH_I,
+};
+
+struct watchpoint {
+  uint8_t kind;
+  // Address for memory, register number for registers
+  uint16_t addr;
+  uint16_t length;
+  // Values as they were last seen
+  uint8_t seen[16];
+};
+
+// Debugger
+// debug_cycle is a drop in for emulate_cycle that checks breakpoints and
+// watchpoints around every instruction. Frontends only swap it in while
+// debug_needed says there's something for it to do, so a ROM being run
+// without any breakpoints pays nothing for the debugger existing.
+struct debugger {
+  // One bit per address
+  uint8_t breakpoints[MEMORY_SIZE / 8];
+  int nbreakpoints;
+
+  struct watchpoint watches[DEBUG_WATCHES];
+  int nwatches;
+
+  // Stop after the next instruction
+  int stepping;
+  // Stop once the stack unwinds to this depth, -1 when not stepping over
+  int step_over_sp;
+  // Let the breakpoint at this address through once, having just stopped
+  // on it
+  int resume_pc;
+
+  // Whether we're stopped, waiting on the prompt
+  int stopped;
+};
+
+void debug_init(struct debugger *d);
+int debug_needed(const struct debugger *d);
+void debug_break(struct debugger *d);
+int debug_cycle(struct debugger *d, struct machine *m);
+int debug_prompt(struct debugger *d, struct machine *m);
+
+#endif // DEBUG_H
@@ -0,0 +1,57 @@
+//
+// Checks the mnemonic table against emulate_cycle's decoding
+//
+// Every one of the 65,536 opcodes is run once on a fresh machine. An opcode
+// with a mnemonic must run, and one without must fault. Instructions that
+// carry on to the next one must also move the PC on by their length.
+//
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "cpu.h"
+#include "disasm.h"
+
+int main() {
+  trace = 0;
+  quiet = 1;
+
+  static struct machine m;
+  int mismatches = 0;
+
+  for (uint32_t op = 0; op <= 0xFFFF; op++) {
+    // Followed by a zero word, so the long I load has something to load
+    uint8_t rom[4] = { op >> 8, op & 0xFF, 0, 0 };
+    initialize(&m, rom, sizeof(rom));
+
+    // Somewhere for RET to go back to
+    m.SP = 1;
+    m.stack[1] = ROM_START;
+
+    const struct mnemonic *mn = find_mnemonic(op);
+    int status = emulate_cycle(&m);
+
+    const char *problem = NULL;
+    if (mn == NULL && status != MACHINE_FAULT) {
+      problem = "runs but has no mnemonic";
+    } else if (mn != NULL && status == MACHINE_FAULT) {
+      problem = "has a mnemonic but faults";
+    } else if (mn != NULL && mn->flow == FLOW_NEXT && status == MACHINE_RUNNING &&
+        m.PC != ROM_START + instruction_length(op)) {
+      problem = "moves the PC on by a different length";
+    }
+
+    if (problem != NULL) {
+      fprintf(stderr, "0x%04X %s\n", op, problem);
+      mismatches++;
+    }
+  }
+
+  if (mismatches > 0) {
+    fprintf(stderr, "%d opcodes decode differently\n", mismatches);
+    return EXIT_FAILURE;
+  }
+
+  printf("All 65536 opcodes decode the same\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,489 @@
+//
+// Differential harness running two interpreter backends side by side
+//
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "cpu.h"
+#include "debug.h"
+#include "disasm.h"
+#include "rom.h"
+
+// Instructions shown leading up to a divergence
+#define TRACE_LENGTH 16
+
+// A way of running the core
+// Backends that can run a single instruction are compared after every one,
+// otherwise only after every frame.
+struct backend {
+  const char *name;
+  const char *description;
+  int (*cycle)(struct machine *m);
+  int (*frame)(struct machine *m, int cycles);
+};
+
+// Attached to the debug backend but never told to stop
+static struct debugger idle_debugger;
+
+static int debug_backend_cycle(struct machine *m) {
+  return debug_cycle(&idle_debugger, m);
+}
+
+static const struct backend backends[] = {
+  { "cycle", "emulate_cycle, one instruction at a time", emulate_cycle, NULL },
+  { "frame", "run_frame, whole frames at a time", NULL, run_frame },
+  { "debug", "debug_cycle with nothing to break on", debug_backend_cycle, NULL },
+};
+
+#define BACKEND_COUNT (sizeof(backends) / sizeof(backends[0]))
+
+// One of the two machines being compared
+struct side {
+  const struct backend *backend;
+  struct machine *m;
+
+  // Rolling hash of every state the machine has been in
+  uint64_t hash;
+
+  // Hash of the display, only taken again once something's drawn
+  uint64_t display_hash;
+  uint32_t display_draws;
+};
+
+// An instruction the reference ran
+struct trace_entry {
+  uint32_t frame;
+  uint16_t pc;
+  uint16_t opcode;
+  uint16_t next;
+};
+
+struct trace {
+  struct trace_entry entries[TRACE_LENGTH];
+  uint32_t count;
+};
+
+struct options {
+  const struct backend *a;
+  const struct backend *b;
+  uint32_t frames;
+  int cycles;
+  uint32_t seed;
+};
+
+// Usage instructions for the harness
+int print_usage() {
+  printf(
+"Usage: dip-diff [options] [-p path_to_pack] [path_to_rom...]\n\n"
+"  -a [backend]           Reference backend (default cycle)\n"
+"  -b [backend]           Backend checked against it (default frame)\n"
+"  -f [frames]            Number of frames to run each ROM for (default 600)\n"
+"  -c [cycles]            Instruction budget per frame (default 10)\n"
+"  -s [seed]              Seed for key presses and RND (default 1)\n"
+"  -p [path_to_pack]      Take ROMs from a pack, all of them if none are named\n\n"
+"  Backends:\n");
+  for (size_t i = 0; i < BACKEND_COUNT; i++) {
+    printf("  %-22s %s\n", backends[i].name, backends[i].description);
+  }
+
+  exit(EXIT_SUCCESS);
+}
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static const struct backend *find_backend(const char *name) {
+  for (size_t i = 0; i < BACKEND_COUNT; i++) {
+    if (!strcmp(backends[i].name, name)) {
+      return &backends[i];
+    }
+  }
+  fprintf(stderr, "No backend called %s\n", name);
+  exit(EXIT_FAILURE);
+}
+
+static uint16_t fetch(const struct machine *m, uint32_t addr) {
+  return m->memory[addr & MEMORY_MASK] << 8 | m->memory[(addr + 1) & MEMORY_MASK];
+}
+
+// Hashing
+
+// Folds the visible state of the machine into the side's rolling hash
+// Registers, I, PC, SP, timers, status and the display are covered, memory
+// isn't but anything different there shows up once it's read back.
+static uint64_t update_hash(struct side *s) {
+  const struct machine *m = s->m;
+  if (s->display_draws != m->draws || s->display_hash == 0) {
+    s->display_hash = rom_hash((const uint8_t *)m->gfx, sizeof(m->gfx));
+    s->display_draws = m->draws;
+  }
+
+  uint8_t state[40];
+  memcpy(state, m->registers, 16);
+  memcpy(state + 16, &m->I, 2);
+  memcpy(state + 18, &m->PC, 2);
+  state[20] = m->SP;
+  state[21] = m->delay_timer;
+  state[22] = m->sound_timer;
+  state[23] = m->status;
+  state[24] = m->hires;
+  state[25] = m->planes;
+  memcpy(state + 26, &m->draws, 4);
+  memcpy(state + 30, &s->display_hash, 8);
+  memcpy(state + 38, &m->stack[m->SP & 0xF], 2);
+
+  s->hash = (s->hash ^ rom_hash(state, sizeof(state))) * 0x100000001b3ULL;
+  return s->hash;
+}
+
+// Input
+
+static uint64_t xorshift(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+// Presses a key now and then so ROMs waiting on input get somewhere
+// The same seed always gives the same presses.
+static void press_keys(uint64_t *rng, uint8_t key[16]) {
+  uint64_t r = xorshift(rng);
+  switch (r & 7) {
+    case 0:
+      memset(key, 0, 16);
+      key[(r >> 3) & 0xF] = 1;
+      break;
+    case 1:
+      memset(key, 0, 16);
+      break;
+  }
+}
+
+// Running
+
+static void record(struct trace *t, uint32_t frame, const struct machine *m) {
+  struct trace_entry *e = &t->entries[t->count++ % TRACE_LENGTH];
+  e->frame = frame;
+  e->pc = m->PC;
+  e->opcode = fetch(m, m->PC);
+  e->next = fetch(m, m->PC + 2);
+}
+
+// Gets a machine ready for a frame the way run_frame does
+static void begin_frame(struct machine *m) {
+  if (!machine_stopped(m->status)) {
+    m->status = MACHINE_RUNNING;
+    m->idle.PC = IDLE_NONE;
+  }
+}
+
+// Runs a frame an instruction at a time, recording each one into trace
+static int cycle_frame(const struct backend *b, struct machine *m, int cycles,
+    uint32_t frame, struct trace *t) {
+  begin_frame(m);
+  int i;
+  for (i = 0; i < cycles && m->status == MACHINE_RUNNING; i++) {
+    if (t != NULL) {
+      record(t, frame, m);
+    }
+    b->cycle(m);
+  }
+  m->cycles += i;
+  end_frame(m);
+  return m->status;
+}
+
+// Runs a frame on a side whichever way the backend can
+static void side_frame(struct side *s, int cycles, uint32_t frame) {
+  if (s->backend->frame != NULL) {
+    s->backend->frame(s->m, cycles);
+  } else {
+    cycle_frame(s->backend, s->m, cycles, frame, NULL);
+  }
+}
+
+// Runs both sides through a frame one instruction at a time, comparing them
+// after each. Returns 0 if they still agree.
+static int lockstep_frame(struct side *a, struct side *b, int cycles, uint32_t frame,
+    struct trace *t, uint64_t *instructions) {
+  begin_frame(a->m);
+  begin_frame(b->m);
+
+  int i;
+  for (i = 0; i < cycles; i++) {
+    int run_a = a->m->status == MACHINE_RUNNING;
+    int run_b = b->m->status == MACHINE_RUNNING;
+    if (!run_a && !run_b) {
+      break;
+    }
+
+    record(t, frame, a->m);
+    if (run_a) {
+      a->backend->cycle(a->m);
+    }
+    if (run_b) {
+      b->backend->cycle(b->m);
+    }
+    (*instructions)++;
+
+    if (update_hash(a) != update_hash(b)) {
+      return -1;
+    }
+  }
+
+  a->m->cycles += i;
+  b->m->cycles += i;
+  end_frame(a->m);
+  end_frame(b->m);
+
+  return update_hash(a) == update_hash(b) ? 0 : -1;
+}
+
+// Reporting
+
+static void print_trace(const struct trace *t) {
+  uint32_t start = t->count > TRACE_LENGTH ? t->count - TRACE_LENGTH : 0;
+  for (uint32_t i = start; i < t->count; i++) {
+    const struct trace_entry *e = &t->entries[i % TRACE_LENGTH];
+    char text[32];
+    disassemble(e->opcode, e->next, text, sizeof(text));
+    printf("    %6u  0x%03X  %04X  %s\n", e->frame, e->pc, e->opcode, text);
+  }
+}
+
+static void print_differences(const struct side *a, const struct side *b) {
+  const struct machine *ma = a->m;
+  const struct machine *mb = b->m;
+
+  printf("  Differences (%s / %s):\n", a->backend->name, b->backend->name);
+  for (int i = 0; i < 16; i++) {
+    if (ma->registers[i] != mb->registers[i]) {
+      printf("    V%X      0x%02X / 0x%02X\n", i, ma->registers[i], mb->registers[i]);
+    }
+  }
+
+#define DIFFERENCE(field, format) \
+  if (ma->field != mb->field) { \
+    printf("    %-7s " format " / " format "\n", #field, ma->field, mb->field); \
+  }
+  DIFFERENCE(I, "0x%03X");
+  DIFFERENCE(PC, "0x%03X");
+  DIFFERENCE(SP, "%u");
+  DIFFERENCE(delay_timer, "%u");
+  DIFFERENCE(sound_timer, "%u");
+  DIFFERENCE(status, "%u");
+  DIFFERENCE(hires, "%u");
+  DIFFERENCE(planes, "%u");
+  DIFFERENCE(draws, "%u");
+#undef DIFFERENCE
+
+  int stack = 0;
+  for (int i = 0; i < 16; i++) {
+    stack += ma->stack[i] != mb->stack[i];
+  }
+  if (stack > 0) {
+    printf("    stack   %d entries differ\n", stack);
+  }
+
+  int rows = 0;
+  for (int p = 0; p < GFX_PLANES; p++) {
+    for (int y = 0; y < GFX_HI_HEIGHT; y++) {
+      rows += memcmp(ma->gfx[p][y], mb->gfx[p][y], sizeof(ma->gfx[p][y])) != 0;
+    }
+  }
+  if (rows > 0) {
+    printf("    display %d rows differ\n", rows);
+  }
+
+  int bytes = 0;
+  for (uint32_t i = 0; i < MEMORY_SIZE; i++) {
+    if (ma->memory[i] != mb->memory[i]) {
+      if (bytes++ == 0) {
+        printf("    memory  first at 0x%03X, 0x%02X / 0x%02X\n", i, ma->memory[i], mb->memory[i]);
+      }
+    }
+  }
+  if (bytes > 1) {
+    printf("    memory  %d bytes differ in all\n", bytes);
+  }
+}
+
+// Runs both backends over a ROM
+// Returns 0 if they agreed for every frame, otherwise prints what led up to
+// the divergence and how it differed and returns -1.
+static int compare_rom(const struct options *o, const char *pack_path, const char *name,
+    const uint8_t *rom, size_t size) {
+  static struct machine machines[3];
+  struct side a = { .backend = o->a, .m = &machines[0] };
+  struct side b = { .backend = o->b, .m = &machines[1] };
+  // Each frame's starting state, for replaying when only whole frames run
+  struct machine *snapshot = &machines[2];
+
+  // RND comes from each machine's own generator, seeded the same
+  initialize(a.m, rom, size);
+  initialize(b.m, rom, size);
+  seed_random(a.m, o->seed);
+  seed_random(b.m, o->seed);
+  memset(a.m->key, 0, 16);
+  memset(b.m->key, 0, 16);
+
+  int lockstep = o->a->cycle != NULL && o->b->cycle != NULL;
+  uint64_t rng = o->seed * 0x9E3779B97F4A7C15ULL + 1;
+  struct trace trace = { .count = 0 };
+  uint64_t instructions = 0;
+  uint32_t frame;
+
+  for (frame = 0; frame < o->frames; frame++) {
+    press_keys(&rng, a.m->key);
+    memcpy(b.m->key, a.m->key, 16);
+
+    if (lockstep) {
+      if (lockstep_frame(&a, &b, o->cycles, frame, &trace, &instructions) < 0) {
+        break;
+      }
+      continue;
+    }
+
+    memcpy(snapshot, a.m, sizeof(*snapshot));
+    uint64_t before = a.m->cycles;
+    side_frame(&a, o->cycles, frame);
+    side_frame(&b, o->cycles, frame);
+    instructions += a.m->cycles - before;
+
+    if (update_hash(&a) != update_hash(&b)) {
+      // Replay the frame from where it started to see what ran
+      const struct backend *reference = o->a->cycle ? o->a : &backends[0];
+      cycle_frame(reference, snapshot, o->cycles, frame, &trace);
+      break;
+    }
+  }
+
+  if (frame == o->frames) {
+    printf("%s: ok, %u frames, %lu instructions, hash %016lx\n", name, o->frames,
+        (unsigned long)instructions, (unsigned long)a.hash);
+    return 0;
+  }
+
+  printf("%s: diverged in frame %u, after %lu instructions\n", name, frame,
+      (unsigned long)instructions);
+  printf("  Last instructions run by %s:\n", lockstep ? o->a->name : "the reference");
+  print_trace(&trace);
+  print_differences(&a, &b);
+  printf("  Repro: dip-diff -a %s -b %s -c %d -s %u -f %u", o->a->name, o->b->name,
+      o->cycles, o->seed, frame + 1);
+  if (pack_path != NULL) {
+    printf(" -p %s", pack_path);
+  }
+  printf(" %s\n", name);
+
+  return -1;
+}
+
+int main(int argc, char **argv) {
+
+  char *pack_path = NULL;
+  struct options o = {
+    .a = &backends[0],
+    .b = &backends[1],
+    .frames = 600,
+    .cycles = 10,
+    .seed = 1,
+  };
+  const char **paths = calloc(argc, sizeof(*paths));
+  int npaths = 0;
+  if (paths == NULL) {
+    exit(EXIT_FAILURE);
+  }
+
+  // Parse arguments, anything that isn't an option is a ROM
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] != '-') {
+      paths[npaths++] = argv[i];
+    } else if (i == argc-1) {
+      print_usage();
+    } else if (!strcmp(argv[i], "-a")) {
+      o.a = find_backend(argv[++i]);
+    } else if (!strcmp(argv[i], "-b")) {
+      o.b = find_backend(argv[++i]);
+    } else if (!strcmp(argv[i], "-f")) {
+      o.frames = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-c")) {
+      o.cycles = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-s")) {
+      o.seed = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-p")) {
+      pack_path = argv[++i];
+    } else {
+      print_usage();
+    }
+  }
+
+  if ((npaths == 0 && pack_path == NULL) || o.cycles < 1) {
+    print_usage();
+  }
+
+  // Nothing but the harness should be writing to stdout
+  trace = 0;
+  quiet = 1;
+  debug_init(&idle_debugger);
+
+  struct rompack pack = { 0 };
+  if (pack_path != NULL && rompack_open(&pack, pack_path) < 0) {
+    fprintf(stderr, "Couldn't open ROM pack %s\n", pack_path);
+    exit(EXIT_FAILURE);
+  }
+
+  // ROMs named on the command line come out of the pack if there is one,
+  // otherwise every ROM in the pack is run
+  static uint8_t buffer[ROM_MAX];
+  uint32_t total = npaths > 0 ? (uint32_t)npaths : pack.count;
+  uint32_t diverged = 0;
+  uint32_t compared = 0;
+  uint64_t start = now_ns();
+
+  for (uint32_t i = 0; i < total; i++) {
+    const char *name = npaths > 0 ? paths[i] : pack.entries[i].name;
+    const uint8_t *rom;
+    size_t size;
+
+    if (pack_path != NULL) {
+      const struct rompack_entry *e = npaths > 0 ? rompack_find(&pack, name) : &pack.entries[i];
+      if (e == NULL) {
+        fprintf(stderr, "No ROM called %s in %s\n", name, pack_path);
+        continue;
+      }
+      rom = rompack_data(&pack, e);
+      size = e->size;
+    } else {
+      long read_bytes = read_rom(buffer, name);
+      if (read_bytes < 0) {
+        continue;
+      }
+      rom = buffer;
+      size = read_bytes;
+    }
+
+    compared++;
+    if (compare_rom(&o, pack_path, name, rom, size) < 0) {
+      diverged++;
+    }
+  }
+
+  printf("%u ROMs compared, %u diverged, %s against %s in %.2fms\n", compared, diverged,
+      o.b->name, o.a->name, (now_ns() - start) / 1e6);
+
+  rompack_close(&pack);
+  free(paths);
+
+  return diverged > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
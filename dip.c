@@ -8,32 +8,103 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL2_gfxPrimitives.h>
 
+#include "capture.h"
+#include "control.h"
 #include "cpu.h"
+#include "debug.h"
+#include "filter.h"
 #include "keypad.h"
+#include "palette.h"
+#include "rom.h"
+#include "stats.h"
 
 int scale = 10;
 
+// Display filters, and the texture they draw into when any are on
+struct filter filter;
+SDL_Texture *screen;
+
+// The machine being run
+struct machine machine;
+
 SDL_AudioSpec have;
 SDL_AudioDeviceID dev;
 
+// Where ROMs come from
+char rom_path[256];
+char pack_path[256];
+struct rompack pack;
+
+// Runtime metrics
+struct stats stats;
+struct stats_reporter reporter;
+
+// Runs an instruction, emulate_cycle unless the debugger has work to do
+int (*cycle)(struct machine *m) = emulate_cycle;
+struct debugger debugger;
+
+// Recording of the display, and 60Hz frames run so far to time it by
+struct capture capture;
+uint64_t frame_count;
+
+// Sprites drawn that have made it to the screen
+uint32_t draws_presented;
+
+// When the oldest input that isn't on screen yet arrived, 0 if there isn't
+// one, and the sprites drawn as of then
+// Inputs that nothing was drawn for within INPUT_TIMEOUT_US aren't counted.
+#define INPUT_TIMEOUT_US 1000000
+uint64_t pending_input_us;
+uint32_t pending_input_draws;
+
+// The ROM that's loaded, kept so the machine can be restarted in place
+uint8_t rom_image[ROM_MAX];
+size_t rom_size;
+
+// Monotonic time in microseconds
+uint64_t now_us() {
+  return (double)SDL_GetPerformanceCounter() * 1e6 / SDL_GetPerformanceFrequency();
+}
+
 // Handles the updating of the screen output
-void update_screen(SDL_Renderer* renderer) {
+void update_screen(SDL_Renderer* renderer, struct machine *m) {
+  if (filter.flags) {
+    uint64_t start = now_us();
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(screen, NULL, &pixels, &pitch) == 0) {
+      filter_render(&filter, m, frame_count, pixels, pitch);
+      SDL_UnlockTexture(screen);
+    }
+    stats_record(&stats.filter_us, now_us() - start);
+
+    SDL_RenderCopy(renderer, screen, NULL, NULL);
+    SDL_RenderPresent(renderer);
+    return;
+  }
+
+  // Hi-res pixels are half the size so the window stays the same
+  int width = gfx_width(m);
+  int height = gfx_height(m);
+  int cell = scale * GFX_WIDTH / width;
+
   // Clear the back buffer
   SDL_SetRenderDrawColor(renderer, 0, 0, 0, 250);
   SDL_RenderClear(renderer);
 
-  SDL_SetRenderDrawColor(renderer, 0, 255, 0, 250);
-
   // Update the screen buffer
-  for (int y = 0; y < 32; y++) {
-    for (int x = 0; x < 64; x++) {
-      if (gfx[x + y * 64] == 1) {
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      int colour = gfx_pixel(m, x, y);
+      if (colour) {
         SDL_Rect rect = {
-          .x = (x * scale),
-          .y = (y * scale),
-          .w = scale,
-          .h = scale
+          .x = (x * cell),
+          .y = (y * cell),
+          .w = cell,
+          .h = cell
         };
+        SDL_SetRenderDrawColor(renderer, palette_red(colour), palette_green(colour),
+            palette_blue(colour), 250);
         SDL_RenderFillRect(renderer, &rect);
       }
     }
@@ -43,36 +114,159 @@ void update_screen(SDL_Renderer* renderer) {
   SDL_RenderPresent(renderer);
 }
 
-// Main function to load a ROM
-size_t load_rom(uint8_t *buffer, char *rom_path) {
-  FILE *fp = NULL;
+// Presents the screen, keeping the display and input metrics up to date
+void present(SDL_Renderer *renderer) {
+  uint64_t start = now_us();
+  update_screen(renderer, &machine);
+  stats_record(&stats.present_us, now_us() - start);
+  capture_frame(&capture, &machine, frame_count);
+  stats_add(&stats.presents, 1);
+
+  // Any sprites drawn since the last present beyond the one we're showing
+  // never got a present of their own
+  if (machine.draws > draws_presented + 1) {
+    stats_add(&stats.presents_skipped, machine.draws - draws_presented - 1);
+  }
+  draws_presented = machine.draws;
+
+  // The first present with a sprite drawn after the input is the first that
+  // can show it
+  if (pending_input_us && machine.draws != pending_input_draws) {
+    uint64_t latency = now_us() - pending_input_us;
+    if (latency < INPUT_TIMEOUT_US) {
+      stats_record(&stats.input_latency_us, latency);
+    }
+    pending_input_us = 0;
+  }
+}
+
+// Notes when an input event arrived, going by SDL's timestamp for it
+void note_input(uint32_t timestamp) {
+  stats_add(&stats.input_events, 1);
+  if (pending_input_us) {
+    return;
+  }
 
-  fp = fopen(rom_path, "rb");
-  if (fp == NULL) {
-    fprintf(stderr, "Doesn't appear to be a file hombre. Try another one\n");
-    exit(2);
+  // Timestamps are in milliseconds, so take how long it sat in the queue
+  // off the precise time now
+  pending_input_us = now_us() - (uint64_t)(SDL_GetTicks() - timestamp) * 1000;
+  pending_input_draws = machine.draws;
+}
+
+// Lets on that the ROM has stopped for good
+void report_stuck() {
+  printf("ROM is stuck at 0x%03X, F5 restarts it\n", machine.PC);
+}
+
+// Runs an instruction under the debugger, dropping into the prompt whenever
+// it stops
+// Once there's nothing left to check it swaps itself back out for
+// emulate_cycle.
+int debug_step(struct machine *m) {
+  int status = debugger.stopped ? m->status : debug_cycle(&debugger, m);
+
+  if (debugger.stopped) {
+    if (debug_prompt(&debugger, m) < 0) {
+      SDL_Event quit = { .type = SDL_QUIT };
+      SDL_PushEvent(&quit);
+    }
+    cycle = debug_needed(&debugger) ? debug_step : emulate_cycle;
   }
 
-  // Get the size of the ROM
-  fseek(fp, 0L, SEEK_END);
-  int sz = ftell(fp);
+  return status;
+}
 
-  // Go back to the beginning
-  rewind(fp);
+// Drops into the debugger before the next instruction
+void break_into_debugger() {
+  debug_break(&debugger);
+  cycle = debug_step;
+}
 
-  size_t read_bytes = fread(buffer, 1, sz, fp);
+// Loads a ROM ready for the next restart
+// If it can't be found the current ROM stays loaded and -1 is returned.
+int load_game(const char *path) {
+  uint8_t buffer[ROM_MAX];
+  size_t size;
 
-  // Close the ROM file
-  fclose(fp);
+  const uint8_t *rom = find_rom(&pack, pack_path, path, buffer, &size);
+  if (rom == NULL) {
+    return -1;
+  }
 
-  return read_bytes;
+  memcpy(rom_image, rom, size);
+  rom_size = size;
+  if (path != rom_path) {
+    strncpy(rom_path, path, sizeof(rom_path) - 1);
+  }
+
+  return 0;
+}
+
+// Restarts the machine with the loaded ROM
+// The window, renderer and audio device are left open, only queued audio is
+// dropped so a beep doesn't carry over.
+void restart_game() {
+  uint64_t start = SDL_GetPerformanceCounter();
+
+  SDL_ClearQueuedAudio(dev);
+  initialize(&machine, rom_image, rom_size);
+  draws_presented = 0;
+
+  uint64_t took = SDL_GetPerformanceCounter() - start;
+  printf("Started %s in %.1fus\n", rom_path,
+      took * 1e6 / SDL_GetPerformanceFrequency());
+}
+
+// Acts on anything that's come in over the control channel
+void handle_control(struct control *ctl) {
+  char arg[256];
+  char reply[1024];
+  size_t len;
+
+  switch (control_poll(ctl, arg, sizeof(arg))) {
+    case CONTROL_RESTART:
+      restart_game();
+      break;
+
+    case CONTROL_RELOAD:
+      // Remap the pack too in case it's been rebuilt
+      rompack_close(&pack);
+      if (load_game(rom_path) == 0) {
+        restart_game();
+      }
+      break;
+
+    case CONTROL_LOAD:
+      if (load_game(arg) == 0) {
+        restart_game();
+      }
+      break;
+
+    case CONTROL_STATS:
+      len = stats_format(&stats, &reporter, now_us(), reply, sizeof(reply));
+      control_reply(ctl, reply, len);
+      break;
+  }
 }
 
 // Usage instructions for the emulator
 int print_usage() {
   printf(
-"Usage: dip -r [path_to_rom]\n\n"
-"  -r [path_to_rom]       Load from from path\n");
+"Usage: dip -r [path_to_rom]\n"
+"       dip -p [path_to_pack] -r [rom_name]\n\n"
+"  -r [path_to_rom]       Load from from path\n"
+"  -p [path_to_pack]      Load the ROM by name from a ROM pack\n"
+"  -s [path_to_socket]    Listen for restart, reload, load and stats commands\n"
+"  -m [path]              Write metrics as JSON lines every second, - for stderr\n"
+"  -o [path]              Record the display to a capture file\n"
+"  -z [scale]             Size of a lo-res pixel in the window (default 10)\n"
+"  -F [filters]           Comma separated display filters: smooth, phosphor\n"
+"                         and scanlines\n"
+"  -k [bindings]          Bind keypad keys as [0-F]=[key], or [0-F]=pad:[button]\n"
+"                         for gamepads, separated by commas\n"
+"  -d                     Start in the debugger, with tracing off\n\n"
+"  F5 restarts the ROM, F6 breaks into the debugger, SIGUSR1 restarts it and\n"
+"  SIGHUP reloads it\n");
 
   exit(EXIT_SUCCESS);
 }
@@ -115,15 +309,69 @@ void update_sound(SDL_AudioDeviceID* dev, SDL_AudioSpec* have, uint8_t* sound_ti
 
 int main(int argc, char **argv) {
 
-  char rom_path[256];
+  char socket_path[256] = "";
+  char stats_path[256] = "";
+  char capture_path[256] = "";
+  int filters = 0;
+
+  debug_init(&debugger);
+  keypad_init();
 
   // Parse arguments
   for (int i = 0; i < argc; i++) {
-    if (!strcmp(argv[i], "-r")) {
+    if (!strcmp(argv[i], "-d")) {
+      trace = 0;
+      break_into_debugger();
+    } else if (!strcmp(argv[i], "-r")) {
       if (i == argc-1) {
         print_usage();
       }
       strncpy(rom_path, argv[++i], sizeof(rom_path));
+    } else if (!strcmp(argv[i], "-p")) {
+      if (i == argc-1) {
+        print_usage();
+      }
+      strncpy(pack_path, argv[++i], sizeof(pack_path));
+    } else if (!strcmp(argv[i], "-s")) {
+      if (i == argc-1) {
+        print_usage();
+      }
+      strncpy(socket_path, argv[++i], sizeof(socket_path));
+    } else if (!strcmp(argv[i], "-m")) {
+      if (i == argc-1) {
+        print_usage();
+      }
+      strncpy(stats_path, argv[++i], sizeof(stats_path));
+    } else if (!strcmp(argv[i], "-o")) {
+      if (i == argc-1) {
+        print_usage();
+      }
+      strncpy(capture_path, argv[++i], sizeof(capture_path));
+    } else if (!strcmp(argv[i], "-z")) {
+      if (i == argc-1) {
+        print_usage();
+      }
+      scale = atoi(argv[++i]);
+      if (scale < 1) {
+        print_usage();
+      }
+    } else if (!strcmp(argv[i], "-k")) {
+      if (i == argc-1) {
+        print_usage();
+      }
+      if (keypad_bind(argv[++i]) < 0) {
+        fprintf(stderr, "Can't bind keys: %s\n", argv[i]);
+        print_usage();
+      }
+    } else if (!strcmp(argv[i], "-F")) {
+      if (i == argc-1) {
+        print_usage();
+      }
+      filters = filter_parse(argv[++i]);
+      if (filters < 0) {
+        fprintf(stderr, "Unknown filter in %s\n", argv[i]);
+        print_usage();
+      }
     } else if (i == argc-1) {
       // If we've run out of arguments to parse, print out the usage
       print_usage();
@@ -132,11 +380,24 @@ int main(int argc, char **argv) {
 
   printf("ROM location: %s\n", rom_path);
   // Load the ROM
-  int bufferSize = 2048;
-  uint8_t buffer[bufferSize];
-  int rom_size = load_rom(buffer, rom_path);
+  if (load_game(rom_path) < 0) {
+    exit(2);
+  }
+
+  printf("ROM size: %zu\n", rom_size);
+
+  struct control ctl;
+  if (control_open(&ctl, socket_path) < 0) {
+    exit(EXIT_FAILURE);
+  }
 
-  printf("ROM size: %d\n", rom_size);
+  if (stats_reporter_open(&reporter, stats_path, 1000000) < 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  if (capture_path[0] != '\0' && capture_open(&capture, capture_path) < 0) {
+    exit(EXIT_FAILURE);
+  }
 
   // Setup graphics and inputs
   // SDL2 bindings here
@@ -145,60 +406,130 @@ int main(int argc, char **argv) {
 
   // Useful for simple alert dialog: https://wiki.libsdl.org/SDL_ShowSimpleMessageBox
 
-  // Init SDL with Video and Audio enabled
-  SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+  // Init SDL with Video, Audio and gamepads enabled
+  SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER);
 
   // Create the window and renderer
-  SDL_CreateWindowAndRenderer(640, 320, 0, &window, &renderer);
+  int width = GFX_WIDTH * scale;
+  int height = GFX_HEIGHT * scale;
+  SDL_CreateWindowAndRenderer(width, height, 0, &window, &renderer);
+
+  // Filters draw every pixel of the window themselves into a texture
+  if (filters) {
+    if (filter_init(&filter, filters, width, height) < 0) {
+      fprintf(stderr, "Window is too big to filter: %dx%d\n", width, height);
+      exit(EXIT_FAILURE);
+    }
+    screen = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STREAMING, width, height);
+  }
 
   SDL_SetWindowTitle(window, "Dip 🕹");
 
   init_audio();
 
   // Initialize the CPU / Memory etc
-  initialize(buffer, bufferSize);
+  restart_game();
 
   uint32_t start_time = SDL_GetTicks();
   uint32_t current_time = 0;
+  uint32_t frame_cycles = 0;
 
   // Main game loop
   while(1) {
     SDL_Event e;
+    int quit = 0;
 
     // Handle input
-    if (SDL_PollEvent(&e)) {
+    // Everything queued is drained at once so no key waits behind another.
+    while (SDL_PollEvent(&e)) {
       if (e.type == SDL_QUIT) {
-        printf("Exiting...\n");
-        break;
+        quit = 1;
+      } else if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F5) {
+        restart_game();
+      } else if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F6) {
+        break_into_debugger();
+      } else if (handle_input(&machine, &e) >= 0) {
+        note_input(e.common.timestamp);
       }
-      handle_input(e);
+    }
+    if (quit) {
+      printf("Exiting...\n");
+      break;
     }
 
     // Emulate a cycle of the CPU
-    // Every millisecond update the cpu
-    emulate_cycle();
+    // Every millisecond update the cpu, unless it's stuck, when the last
+    // thing it drew stays up until it's restarted
+    if (machine.status != MACHINE_STUCK) {
+      int status = cycle(&machine);
+      if (status == MACHINE_FAULT) {
+        exit(EXIT_FAILURE);
+      }
+      if (status == MACHINE_HALTED) {
+        printf("Exiting...\n");
+        break;
+      }
+      if (status == MACHINE_STUCK) {
+        report_stuck();
+      }
+      frame_cycles++;
+    }
 
     current_time = SDL_GetTicks();
     if (current_time > start_time + 15) {
       // Should be 60Hz
-      update_timers();
+      int stuck = machine.status == MACHINE_STUCK;
+      end_frame(&machine);
+      if (!stuck && machine.status == MACHINE_STUCK) {
+        report_stuck();
+      }
+      frame_count++;
+
+      stats_add(&stats.instructions, frame_cycles);
+      stats_add(&stats.frames, 1);
+      stats_set(&stats.cycles_per_frame, frame_cycles);
+      frame_cycles = 0;
+
+      // An empty queue means the device ran dry since the last frame
+      uint32_t queued = SDL_GetQueuedAudioSize(dev);
+      stats_set(&stats.audio_queued, queued);
+      if (queued == 0) {
+        stats_add(&stats.audio_underruns, 1);
+      }
 
-      update_sound(&dev, &have, &sound_timer);
+      update_sound(&dev, &have, &machine.sound_timer);
       start_time = SDL_GetTicks();
+
+      handle_control(&ctl);
+      stats_report(&reporter, &stats, now_us());
+
+      // Phosphor keeps fading after the last sprite was drawn
+      if (!machine.drawFlag && filter_fading(&filter)) {
+        update_screen(renderer, &machine);
+      }
     }
 
     // Handle screen update
-    if (drawFlag) {
-      update_screen(renderer);
+    if (machine.drawFlag) {
+      present(renderer);
       // Set back to 0
-      drawFlag = 0;
+      machine.drawFlag = 0;
     }
 
     // Add a delay
     SDL_Delay(1);
   }
 
+  control_close(&ctl);
+  stats_reporter_close(&reporter);
+  capture_close(&capture);
+  rompack_close(&pack);
+
   // Tear down SDL bindings
+  if (screen != NULL) {
+    SDL_DestroyTexture(screen);
+  }
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
   SDL_Quit();
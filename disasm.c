@@ -0,0 +1,136 @@
+//
+// Mnemonics for every instruction, shared by tracing, the debugger and
+// dip-disasm
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "disasm.h"
+
+// Matched in order, so specific encodings come before the broader ones
+// Mirrors the decoding in emulate_cycle, anything missing here faults there.
+// make check-decode runs every opcode through both to keep them in step.
+const struct mnemonic mnemonics[] = {
+  { 0xF0FF, 0x00E0, "CLS",                 "",    FLOW_NEXT,     ISA_CHIP8,  0 },
+  { 0xF0FF, 0x00EE, "RET",                 "",    FLOW_RETURN,   ISA_CHIP8,  0 },
+  { 0xF0FF, 0x00FB, "SCR",                 "",    FLOW_NEXT,     ISA_SCHIP,  0 },
+  { 0xF0FF, 0x00FC, "SCL",                 "",    FLOW_NEXT,     ISA_SCHIP,  0 },
+  { 0xF0FF, 0x00FD, "EXIT",                "",    FLOW_STOP,     ISA_SCHIP,  0 },
+  { 0xF0FF, 0x00FE, "LOW",                 "",    FLOW_NEXT,     ISA_SCHIP,  0 },
+  { 0xF0FF, 0x00FF, "HIGH",                "",    FLOW_NEXT,     ISA_SCHIP,  0 },
+  { 0xF0FF, 0x0000, "SYS %X",              "a",   FLOW_JUMP,     ISA_CHIP8,  0 },
+  { 0xFFF0, 0x00C0, "SCD 0x%X",            "n",   FLOW_NEXT,     ISA_SCHIP,  0 },
+  { 0xFFF0, 0x00D0, "SCU 0x%X",            "n",   FLOW_NEXT,     ISA_XOCHIP, 0 },
+  { 0xF000, 0x1000, "JP 0x%X",             "a",   FLOW_JUMP,     ISA_CHIP8,  0 },
+  { 0xF000, 0x2000, "CALL 0x%X",           "a",   FLOW_CALL,     ISA_CHIP8,  0 },
+  { 0xF000, 0x3000, "SE V%X, 0x%X",        "xk",  FLOW_SKIP,     ISA_CHIP8,  0 },
+  { 0xF000, 0x4000, "SNE V%X, %X",         "xk",  FLOW_SKIP,     ISA_CHIP8,  0 },
+  { 0xF00F, 0x5000, "SE V%X, V%X",         "xy",  FLOW_SKIP,     ISA_CHIP8,  0 },
+  { 0xF00F, 0x5002, "SAVE V%X - V%X",      "xy",  FLOW_NEXT,     ISA_XOCHIP, 0 },
+  { 0xF00F, 0x5003, "LOAD V%X - V%X",      "xy",  FLOW_NEXT,     ISA_XOCHIP, 0 },
+  { 0xF000, 0x6000, "LD V%X, 0x%X",        "xk",  FLOW_NEXT,     ISA_CHIP8,  0 },
+  { 0xF000, 0x7000, "ADD V%X, 0x%x",       "xk",  FLOW_NEXT,     ISA_CHIP8,  0 },
+  { 0xF00F, 0x8000, "LD V%X, V%X",         "xy",  FLOW_NEXT,     ISA_CHIP8,  0 },
+  { 0xF00F, 0x8001, "OR V%X, V%X",         "xy",  FLOW_NEXT,     ISA_CHIP8,  QUIRK_LOGIC },
+  { 0xF00F, 0x8002, "AND V%X, V%X",        "xy",  FLOW_NEXT,     ISA_CHIP8,  QUIRK_LOGIC },
+  { 0xF00F, 0x8003, "XOR V%X, V%X",        "xy",  FLOW_NEXT,     ISA_CHIP8,  QUIRK_LOGIC },
+  { 0xF00F, 0x8004, "ADD V%X, V%X",        "xy",  FLOW_NEXT,     ISA_CHIP8,  0 },
+  { 0xF00F, 0x8005, "SUB V%X, V%X",        "xy",  FLOW_NEXT,     ISA_CHIP8,  0 },
+  { 0xF00F, 0x8006, "SHR V%X {, V%X}",     "xy",  FLOW_NEXT,     ISA_CHIP8,  QUIRK_SHIFT },
+  { 0xF00F, 0x8007, "SUBN V%X, V%X",       "xy",  FLOW_NEXT,     ISA_CHIP8,  0 },
+  { 0xF00F, 0x800E, "SHL V%X {, V%X}",     "xy",  FLOW_NEXT,     ISA_CHIP8,  QUIRK_SHIFT },
+  { 0xF000, 0x9000, "SNE V%X, V%X",        "xy",  FLOW_SKIP,     ISA_CHIP8,  0 },
+  { 0xF000, 0xA000, "LD I, 0x%X",          "a",   FLOW_NEXT,     ISA_CHIP8,  0 },
+  { 0xF000, 0xB000, "JP V0, 0x%X",         "a",   FLOW_INDIRECT, ISA_CHIP8,  QUIRK_JUMP },
+  { 0xF000, 0xC000, "RND V%X, %X",         "xk",  FLOW_NEXT,     ISA_CHIP8,  0 },
+  { 0xF000, 0xD000, "DRW V%X, V%X, 0x%X",  "xyn", FLOW_NEXT,     ISA_CHIP8,  QUIRK_DRAW },
+  { 0xF0FF, 0xE09E, "SKP V%X",             "x",   FLOW_SKIP,     ISA_CHIP8,  0 },
+  { 0xF0FF, 0xE0A1, "SKNP V%X",            "x",   FLOW_SKIP,     ISA_CHIP8,  0 },
+  { 0xFFFF, 0xF000, "LD I, long 0x%X",     "l",   FLOW_NEXT,     ISA_XOCHIP, 0 },
+  { 0xF0FF, 0xF001, "PLANE %X",            "x",   FLOW_NEXT,     ISA_XOCHIP, 0 },
+  { 0xF0FF, 0xF002, "AUDIO",               "",    FLOW_NEXT,     ISA_XOCHIP, 0 },
+  { 0xF0FF, 0xF007, "LD V%X, DT",          "x",   FLOW_NEXT,     ISA_CHIP8,  0 },
+  { 0xF0FF, 0xF00A, "LD V%X, K",           "x",   FLOW_NEXT,     ISA_CHIP8,  0 },
+  { 0xF0FF, 0xF015, "LD DT, V%X",          "x",   FLOW_NEXT,     ISA_CHIP8,  0 },
+  { 0xF0FF, 0xF018, "LD ST, V%X",          "x",   FLOW_NEXT,     ISA_CHIP8,  0 },
+  { 0xF0FF, 0xF01E, "ADD I, V%X",          "x",   FLOW_NEXT,     ISA_CHIP8,  0 },
+  { 0xF0FF, 0xF029, "LD F, V%X",           "x",   FLOW_NEXT,     ISA_CHIP8,  0 },
+  { 0xF0FF, 0xF030, "LD HF, V%X",          "x",   FLOW_NEXT,     ISA_SCHIP,  0 },
+  { 0xF0FF, 0xF033, "LD B, V%X",           "x",   FLOW_NEXT,     ISA_CHIP8,  0 },
+  { 0xF0FF, 0xF03A, "PITCH V%X",           "x",   FLOW_NEXT,     ISA_XOCHIP, 0 },
+  { 0xF0FF, 0xF055, "LD [I], V%X",         "x",   FLOW_NEXT,     ISA_CHIP8,  QUIRK_MEMORY },
+  { 0xF0FF, 0xF065, "LD V%X, [I]",         "x",   FLOW_NEXT,     ISA_CHIP8,  QUIRK_MEMORY },
+  { 0xF0FF, 0xF075, "LD R, V%X",           "x",   FLOW_NEXT,     ISA_SCHIP,  0 },
+  { 0xF0FF, 0xF085, "LD V%X, R",           "x",   FLOW_NEXT,     ISA_SCHIP,  0 },
+};
+
+const size_t mnemonic_count = sizeof(mnemonics) / sizeof(mnemonics[0]);
+
+const char *const quirk_names[QUIRK_COUNT] = {
+  "shift", "memory", "jump", "logic", "draw"
+};
+
+// Looks up the mnemonic for an opcode, NULL if it isn't an instruction
+const struct mnemonic *find_mnemonic(uint16_t opcode) {
+  for (size_t i = 0; i < mnemonic_count; i++) {
+    if ((opcode & mnemonics[i].mask) == mnemonics[i].match) {
+      return &mnemonics[i];
+    }
+  }
+  return NULL;
+}
+
+// Bytes taken up by an instruction, XO-CHIP's F000 nnnn is twice as long as
+// everything else
+size_t instruction_length(uint16_t opcode) {
+  return opcode == 0xF000 ? 4 : 2;
+}
+
+// Writes out an instruction as text
+// next is the word after the opcode, only F000 nnnn uses it. Returns how many
+// bytes the instruction takes up, 2 for anything that isn't an instruction.
+size_t disassemble(uint16_t opcode, uint16_t next, char *buf, size_t size) {
+  const struct mnemonic *mn = find_mnemonic(opcode);
+  if (mn == NULL) {
+    snprintf(buf, size, "DW 0x%04X", opcode);
+    return 2;
+  }
+
+  unsigned args[3] = { 0 };
+  for (int i = 0; i < 3 && mn->args[i] != '\0'; i++) {
+    switch (mn->args[i]) {
+      case 'x': args[i] = (opcode >> 8) & 0xF; break;
+      case 'y': args[i] = (opcode >> 4) & 0xF; break;
+      case 'n': args[i] = opcode & 0xF; break;
+      case 'k': args[i] = opcode & 0xFF; break;
+      case 'a': args[i] = opcode & 0xFFF; break;
+      case 'l': args[i] = next; break;
+    }
+  }
+  snprintf(buf, size, mn->format, args[0], args[1], args[2]);
+
+  return instruction_length(opcode);
+}
+
+// Writes out the usual shorthand for an instruction's encoding, like 8xy4 or
+// Fx55, buf needs room for 10 characters
+void opcode_pattern(const struct mnemonic *mn, char *buf) {
+  static const char hex[] = "0123456789ABCDEF";
+  for (int i = 0; i < 4; i++) {
+    int shift = 12 - i * 4;
+    buf[i] = hex[(mn->match >> shift) & 0xF];
+  }
+  buf[4] = '\0';
+
+  for (const char *a = mn->args; *a != '\0'; a++) {
+    switch (*a) {
+      case 'x': buf[1] = 'x'; break;
+      case 'y': buf[2] = 'y'; break;
+      case 'n': buf[3] = 'n'; break;
+      case 'k': buf[2] = buf[3] = 'k'; break;
+      case 'a': buf[1] = buf[2] = buf[3] = 'n'; break;
+      case 'l': strcpy(buf + 4, " nnnn"); break;
+    }
+  }
+}
@@ -0,0 +1,61 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Where control goes after an instruction
+enum flow {
+  FLOW_NEXT,     // On to the following instruction
+  FLOW_SKIP,     // Either the following instruction or the one after it
+  FLOW_JUMP,     // To its address
+  FLOW_CALL,     // To its address, coming back to the following instruction
+  FLOW_RETURN,   // Back to whoever called
+  FLOW_INDIRECT, // To its address plus a register, only known at runtime
+  FLOW_STOP,     // Nowhere, the machine halts
+};
+
+// Instruction set an instruction first appeared in
+enum isa {
+  ISA_CHIP8,
+  ISA_SCHIP,
+  ISA_XOCHIP,
+};
+
+// Instructions whose behaviour interpreters disagree on
+enum quirk {
+  QUIRK_SHIFT = 1 << 0,  // 8xy6 and 8xyE shift Vy, or Vx in place
+  QUIRK_MEMORY = 1 << 1, // Fx55 and Fx65 leave I incremented, or not
+  QUIRK_JUMP = 1 << 2,   // Bnnn adds V0, or Vx
+  QUIRK_LOGIC = 1 << 3,  // 8xy1 to 8xy3 reset VF, or not
+  QUIRK_DRAW = 1 << 4,   // Dxyn clips at the edges or wraps, and may wait for vblank
+};
+
+#define QUIRK_COUNT 5
+
+// An instruction's mnemonic
+// Operands are printf'd in the order given by args, one letter each:
+// x and y are the register nibbles, n the low nibble, k the low byte, a the
+// 12-bit address and l the 16-bit word following the opcode.
+struct mnemonic {
+  uint16_t mask;
+  uint16_t match;
+  const char *format;
+  const char *args;
+  uint8_t flow;
+  uint8_t isa;
+  uint8_t quirks;
+};
+
+// Every instruction emulate_cycle understands, in matching order
+extern const struct mnemonic mnemonics[];
+extern const size_t mnemonic_count;
+
+extern const char *const quirk_names[QUIRK_COUNT];
+
+const struct mnemonic *find_mnemonic(uint16_t opcode);
+size_t instruction_length(uint16_t opcode);
+size_t disassemble(uint16_t opcode, uint16_t next, char *buf, size_t size);
+void opcode_pattern(const struct mnemonic *mn, char *buf);
+
+#endif // DISASM_H
@@ -0,0 +1,241 @@
+//
+// Display filters drawn on the CPU: smoothing, phosphor and scanlines
+//
+#include <stdint.h>
+#include <string.h>
+
+#include "filter.h"
+#include "palette.h"
+
+// Four ARGB pixels, or their sixteen bytes, at a time
+// GCC and Clang's vector extensions turn these into SSE2 or NEON.
+typedef uint8_t bytes16 __attribute__((vector_size(16)));
+typedef uint32_t pixels4 __attribute__((vector_size(16)));
+
+static const struct {
+  const char *name;
+  int flag;
+} filter_names[] = {
+  { "smooth", FILTER_SMOOTH },
+  { "phosphor", FILTER_PHOSPHOR },
+  { "scanlines", FILTER_SCANLINES },
+};
+
+static inline bytes16 load16(const void *p) {
+  bytes16 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline void store16(void *p, bytes16 v) {
+  memcpy(p, &v, sizeof(v));
+}
+
+// Parses a comma separated list of filter names
+// Returns the flags for them, or -1 if there's one that isn't known.
+int filter_parse(const char *spec) {
+  int flags = 0;
+
+  while (*spec != '\0') {
+    size_t len = strcspn(spec, ",");
+    size_t i;
+    for (i = 0; i < sizeof(filter_names) / sizeof(filter_names[0]); i++) {
+      if (strlen(filter_names[i].name) == len && !strncmp(filter_names[i].name, spec, len)) {
+        break;
+      }
+    }
+    if (i == sizeof(filter_names) / sizeof(filter_names[0])) {
+      return -1;
+    }
+
+    flags |= filter_names[i].flag;
+    spec += len;
+    if (*spec == ',') {
+      spec++;
+    }
+  }
+
+  return flags;
+}
+
+// Sets up filters drawing into width * height pixels
+// Returns -1 if that's bigger than they can draw.
+int filter_init(struct filter *f, int flags, int width, int height) {
+  if (width < 1 || width > FILTER_MAX_WIDTH || height < 1 || height > FILTER_MAX_HEIGHT) {
+    return -1;
+  }
+
+  memset(f, 0, sizeof(*f));
+  f->flags = flags;
+  f->width = width;
+  f->height = height;
+
+  return 0;
+}
+
+// Whether phosphor is still fading, so frames want presenting even when
+// nothing's been drawn
+int filter_fading(const struct filter *f) {
+  return f->fading > 0;
+}
+
+// Unpacks the display into ARGB at its own resolution
+static void unpack(const struct machine *m, uint32_t *out) {
+  int height = gfx_height(m);
+  int words = gfx_width(m) / 64;
+
+  for (int y = 0; y < height; y++) {
+    for (int w = 0; w < words; w++) {
+      uint64_t p0 = m->gfx[0][y][w];
+      uint64_t p1 = m->gfx[1][y][w];
+      for (int bit = 63; bit >= 0; bit--) {
+        *out++ = palette[((p0 >> bit) & 1) | ((p1 >> bit) & 1) << 1];
+      }
+    }
+  }
+}
+
+// Doubles the display, rounding off diagonal edges with Scale2x
+// This runs at the display's own resolution so it's cheap enough as is.
+static void smooth(const uint32_t *in, int width, int height, uint32_t *out) {
+  for (int y = 0; y < height; y++) {
+    const uint32_t *above = in + (y > 0 ? y - 1 : y) * width;
+    const uint32_t *row = in + y * width;
+    const uint32_t *below = in + (y < height - 1 ? y + 1 : y) * width;
+    uint32_t *out0 = out + y * 2 * width * 2;
+    uint32_t *out1 = out0 + width * 2;
+
+    for (int x = 0; x < width; x++) {
+      uint32_t p = row[x];
+      uint32_t a = above[x];
+      uint32_t d = below[x];
+      uint32_t c = row[x > 0 ? x - 1 : x];
+      uint32_t b = row[x < width - 1 ? x + 1 : x];
+
+      if (a != d && c != b) {
+        out0[x * 2] = c == a ? c : p;
+        out0[x * 2 + 1] = a == b ? b : p;
+        out1[x * 2] = c == d ? c : p;
+        out1[x * 2 + 1] = b == d ? b : p;
+      } else {
+        out0[x * 2] = out0[x * 2 + 1] = out1[x * 2] = out1[x * 2 + 1] = p;
+      }
+    }
+  }
+}
+
+// Halves the glow for every frame since it was last faded, then lights it
+// back up wherever the display is brighter
+static void phosphor(struct filter *f, const struct machine *m, const uint32_t *image,
+    uint64_t frame) {
+  uint64_t elapsed = frame - f->glow_frame;
+  int shift = elapsed < FILTER_FADE_FRAMES ? elapsed : FILTER_FADE_FRAMES;
+  f->glow_frame = frame;
+
+  if (m->draws != f->draws) {
+    f->draws = m->draws;
+    f->fading = FILTER_FADE_FRAMES;
+  } else {
+    f->fading = f->fading > shift ? f->fading - shift : 0;
+  }
+
+  size_t bytes = (size_t)f->source_width * f->source_height * sizeof(*image);
+  uint8_t *glow = (uint8_t *)f->glow;
+  const uint8_t *lit = (const uint8_t *)image;
+
+  for (size_t i = 0; i < bytes; i += 16) {
+    bytes16 g = shift < 8 ? load16(glow + i) >> shift : (bytes16){ 0 };
+    bytes16 c = load16(lit + i);
+    bytes16 brighter = (bytes16)(c > g);
+    store16(glow + i, (c & brighter) | (g & ~brighter));
+  }
+}
+
+// Works out which output columns and rows each source pixel covers
+static void map_source(struct filter *f, int width, int height) {
+  f->source_width = width;
+  f->source_height = height;
+  for (int x = 0; x <= width; x++) {
+    f->xstart[x] = (x * f->width + width - 1) / width;
+  }
+  for (int y = 0; y <= height; y++) {
+    f->ystart[y] = (y * f->height + height - 1) / height;
+  }
+
+  // The glow from another resolution doesn't line up
+  memset(f->glow, 0, sizeof(f->glow));
+}
+
+// Scales a source row up into f->row
+// Each pixel is stored four at a time, spilling into the next pixel's
+// columns which it then writes over.
+static void expand_row(struct filter *f, const uint32_t *src) {
+  for (int x = 0; x < f->source_width; x++) {
+    pixels4 v = { src[x], src[x], src[x], src[x] };
+    for (int out = f->xstart[x]; out < f->xstart[x + 1]; out += 4) {
+      memcpy(&f->row[out], &v, sizeof(v));
+    }
+  }
+}
+
+// Copies a scaled row out at 5/8 brightness
+static void darken_row(const uint32_t *row, uint32_t *out, int width) {
+  const pixels4 opaque = { 0xFF000000, 0xFF000000, 0xFF000000, 0xFF000000 };
+  int x;
+  for (x = 0; x + 4 <= width; x += 4) {
+    bytes16 v = load16(&row[x]);
+    pixels4 dark = (pixels4)((v >> 1) + (v >> 3)) | opaque;
+    memcpy(&out[x], &dark, sizeof(dark));
+  }
+  for (; x < width; x++) {
+    uint32_t p = row[x];
+    out[x] = ((p >> 1) & 0x7F7F7F) + ((p >> 3) & 0x1F1F1F) + 0xFF000000;
+  }
+}
+
+// Draws the display through the filters into pixels, pitch bytes a row
+// frame is the 60Hz frame being shown, phosphor fades by how many have gone
+// by since the last one.
+void filter_render(struct filter *f, const struct machine *m, uint64_t frame,
+    uint32_t *pixels, int pitch) {
+  int width = gfx_width(m);
+  int height = gfx_height(m);
+
+  const uint32_t *image = f->display;
+  unpack(m, f->display);
+  if (f->flags & FILTER_SMOOTH) {
+    smooth(f->display, width, height, f->source);
+    image = f->source;
+    width *= 2;
+    height *= 2;
+  }
+
+  if (width != f->source_width || height != f->source_height) {
+    map_source(f, width, height);
+  }
+
+  if (f->flags & FILTER_PHOSPHOR) {
+    phosphor(f, m, image, frame);
+    image = f->glow;
+  }
+
+  // Scanlines darken the lower half of each of the display's own lines
+  int lines = gfx_height(m) * 2;
+
+  for (int y = 0; y < height; y++) {
+    expand_row(f, image + y * width);
+    int darkened = 0;
+    for (int out = f->ystart[y]; out < f->ystart[y + 1]; out++) {
+      uint32_t *dest = (uint32_t *)((uint8_t *)pixels + out * pitch);
+      if ((f->flags & FILTER_SCANLINES) && (out * lines / f->height) & 1) {
+        if (!darkened) {
+          darken_row(f->row, f->dark, f->width);
+          darkened = 1;
+        }
+        memcpy(dest, f->dark, f->width * sizeof(*dest));
+      } else {
+        memcpy(dest, f->row, f->width * sizeof(*dest));
+      }
+    }
+  }
+}
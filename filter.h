@@ -0,0 +1,67 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+// Display filters, any combination of them can be on
+enum filter_flags {
+  FILTER_SMOOTH = 1 << 0,    // Scale2x edge smoothing
+  FILTER_PHOSPHOR = 1 << 1,  // Lit pixels fade out over a few frames
+  FILTER_SCANLINES = 1 << 2, // The lower half of every line is darker
+};
+
+// Frames it takes a lit pixel to fade out with phosphor on, it halves in
+// brightness every frame
+#define FILTER_FADE_FRAMES 8
+
+// Largest output the filters will draw
+#define FILTER_MAX_WIDTH 3840
+#define FILTER_MAX_HEIGHT 2160
+
+// Smoothing doubles the display before it's scaled up
+#define FILTER_SOURCE_WIDTH (GFX_HI_WIDTH * 2)
+#define FILTER_SOURCE_HEIGHT (GFX_HI_HEIGHT * 2)
+
+// Renders the display into ARGB pixels through the filters
+// Everything runs on the CPU into the pixels of a streaming texture. The
+// display is filtered at its own resolution, then each row is scaled up once
+// and copied, or darkened for scanlines, into every output row it covers.
+struct filter {
+  int flags;
+  int width;
+  int height;
+
+  // Display as ARGB at its own resolution
+  uint32_t display[GFX_HI_HEIGHT * GFX_HI_WIDTH];
+
+  // Display after smoothing, and how big it is
+  _Alignas(16) uint32_t source[FILTER_SOURCE_HEIGHT * FILTER_SOURCE_WIDTH];
+  int source_width;
+  int source_height;
+
+  // First output column and row each source pixel covers
+  uint16_t xstart[FILTER_SOURCE_WIDTH + 1];
+  uint16_t ystart[FILTER_SOURCE_HEIGHT + 1];
+
+  // Phosphor glow, at the same size as source, the frame it was last faded
+  // at, the sprites drawn as of then, and how many frames it has left to fade
+  _Alignas(16) uint32_t glow[FILTER_SOURCE_HEIGHT * FILTER_SOURCE_WIDTH];
+  uint64_t glow_frame;
+  uint32_t draws;
+  int fading;
+
+  // A source row scaled up, with room to spill over the end, and darkened
+  // for scanlines
+  _Alignas(16) uint32_t row[FILTER_MAX_WIDTH + 4];
+  _Alignas(16) uint32_t dark[FILTER_MAX_WIDTH];
+};
+
+int filter_parse(const char *spec);
+int filter_init(struct filter *f, int flags, int width, int height);
+int filter_fading(const struct filter *f);
+void filter_render(struct filter *f, const struct machine *m, uint64_t frame,
+    uint32_t *pixels, int pitch);
+
+#endif // FILTER_H
@@ -0,0 +1,349 @@
+//
+// Headless host for running many Dip sessions at once
+//
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "capture.h"
+#include "cpu.h"
+#include "image.h"
+#include "pool.h"
+#include "rom.h"
+#include "sched.h"
+#include "stats.h"
+#include "store.h"
+#include "stream.h"
+
+// A 60Hz frame in nanoseconds
+#define FRAME_NS (1000000000L / 60)
+
+// Usage instructions for the host
+int print_usage() {
+  printf(
+"Usage: dip-host -r [path_to_rom] [options]\n\n"
+"  -r [path_to_rom]       Load from from path\n"
+"  -p [path_to_pack]      Load the ROM by name from a ROM pack\n"
+"  -n [sessions]          Number of sessions to host (default 1)\n"
+"  -t [threads]           Number of worker threads (default 1)\n"
+"  -f [frames]            Number of frames to run (default 600)\n"
+"  -c [cycles]            Instruction budget per session per frame (default 10)\n"
+"  -R                     Pace frames in real time at 60Hz\n"
+"  -m [path]              Write metrics as JSON lines every second, - for stderr\n"
+"  -o [path]              Record the display of the first session to a capture file\n"
+"  -S [address]           Stream displays to viewers on [host]:port or a UNIX socket path\n"
+"  -H [path]              Hibernate sessions waiting on a key to a store, resuming\n"
+"                         any already in it\n"
+"  -i [frames]            Frames a session waits on a key before it's hibernated\n"
+"                         (default 600)\n");
+
+  exit(EXIT_SUCCESS);
+}
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// Whether a session is hibernated, in which case its machine is the copy in
+// its slot
+static int hibernated(const struct store *store, struct session **handles, size_t i) {
+  return store->base != NULL && handles[i]->m == &store_slot(store, i)->m;
+}
+
+// Moves a session waiting on a key out to its slot, giving its machine back
+// to the pool
+static void hibernate(struct store *store, struct machine_pool *pool,
+    struct stream *stream, struct session **handles, size_t i) {
+  struct machine *m = handles[i]->m;
+  store_save(store, i, m, STORE_PARKED);
+  handles[i]->m = &store_slot(store, i)->m;
+  stream_attach(stream, i, handles[i]->m);
+  pool_evict(pool, m);
+}
+
+// Pages a hibernated session back in from its slot, over the ROM image so
+// only the pages it had written come back as its own
+// Returns -1, leaving it hibernated, if there's no machine free for it.
+static int wake(struct store *store, struct machine_pool *pool, const struct rom_image *image,
+    struct stream *stream, struct session **handles, size_t i) {
+  struct machine *m = pool_acquire(pool);
+  if (m == NULL) {
+    return -1;
+  }
+
+  // If the image can't be mapped the machine is left cleared, and store_load
+  // copies every page in instead, so either way it comes back whole
+  image_map(image, m);
+  store_load(store, i, m);
+  handles[i]->m = m;
+  stream_attach(stream, i, m);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+
+  char rom_path[256] = "";
+  char pack_path[256] = "";
+  char stats_path[256] = "";
+  char capture_path[256] = "";
+  char stream_addr[256] = "";
+  char store_path[256] = "";
+  long idle_frames = 600;
+  size_t sessions = 1;
+  int threads = 1;
+  long frames = 600;
+  uint32_t cycles = 10;
+  int realtime = 0;
+
+  // Parse arguments
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-R")) {
+      realtime = 1;
+    } else if (i == argc-1) {
+      print_usage();
+    } else if (!strcmp(argv[i], "-r")) {
+      strncpy(rom_path, argv[++i], sizeof(rom_path) - 1);
+    } else if (!strcmp(argv[i], "-p")) {
+      strncpy(pack_path, argv[++i], sizeof(pack_path) - 1);
+    } else if (!strcmp(argv[i], "-m")) {
+      strncpy(stats_path, argv[++i], sizeof(stats_path) - 1);
+    } else if (!strcmp(argv[i], "-o")) {
+      strncpy(capture_path, argv[++i], sizeof(capture_path) - 1);
+    } else if (!strcmp(argv[i], "-S")) {
+      strncpy(stream_addr, argv[++i], sizeof(stream_addr) - 1);
+    } else if (!strcmp(argv[i], "-H")) {
+      strncpy(store_path, argv[++i], sizeof(store_path) - 1);
+    } else if (!strcmp(argv[i], "-i")) {
+      idle_frames = atol(argv[++i]);
+    } else if (!strcmp(argv[i], "-n")) {
+      sessions = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-t")) {
+      threads = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-f")) {
+      frames = atol(argv[++i]);
+    } else if (!strcmp(argv[i], "-c")) {
+      cycles = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage();
+    }
+  }
+
+  if (rom_path[0] == '\0') {
+    print_usage();
+  }
+
+  // Nobody's watching a trace from thousands of sessions
+  trace = 0;
+
+  // Load the ROM, every session shares one image of it
+  struct rompack pack = { 0 };
+  uint8_t buffer[ROM_MAX];
+  size_t rom_size;
+  const uint8_t *rom = find_rom(&pack, pack_path, rom_path, buffer, &rom_size);
+  if (rom == NULL) {
+    exit(2);
+  }
+
+  struct machine_pool *pool = pool_create(sessions);
+  struct sched *s = sched_create(threads, sessions);
+  if (pool == NULL || s == NULL) {
+    fprintf(stderr, "Couldn't allocate %zu sessions\n", sessions);
+    exit(EXIT_FAILURE);
+  }
+
+  struct stream stream;
+  struct session **handles = malloc(sessions * sizeof(*handles));
+  if (handles == NULL || stream_open(&stream, stream_addr, sessions) < 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  // Without an image every session copies the ROM into its own memory
+  struct rom_image image;
+  image_create(&image, rom, rom_size);
+
+  struct store store = { 0 };
+  if (store_path[0] != '\0' &&
+      store_open(&store, store_path, sessions, rom_hash(rom, rom_size)) < 0) {
+    fprintf(stderr, "Couldn't open session store %s, or it's for another ROM or build\n",
+        store_path);
+    exit(EXIT_FAILURE);
+  }
+
+  // Sessions left in the store carry on where they were, those that were
+  // hibernated stay that way until a key comes for them
+  size_t resumed = 0;
+  for (size_t i = 0; i < sessions; i++) {
+    int state = store.base != NULL ? store_slot(&store, i)->state : STORE_EMPTY;
+    if (state == STORE_PARKED) {
+      handles[i] = sched_add(s, &store_slot(&store, i)->m, cycles);
+      sched_park(s, handles[i]);
+      stream_attach(&stream, i, handles[i]->m);
+      store_evict(&store, i);
+      resumed++;
+      continue;
+    }
+
+    struct machine *m = pool_acquire(pool);
+    if (m == NULL) {
+      fprintf(stderr, "Couldn't allocate %zu sessions\n", sessions);
+      exit(EXIT_FAILURE);
+    }
+    int mapped = image_map(&image, m) == 0;
+    if (state == STORE_RUNNING) {
+      store_load(&store, i, m);
+      resumed++;
+    } else if (!mapped) {
+      initialize(m, rom, rom_size);
+    }
+    handles[i] = sched_add(s, m, cycles);
+    stream_attach(&stream, i, m);
+  }
+  rompack_close(&pack);
+
+  if (resumed > 0) {
+    fprintf(stderr, "Resumed %zu sessions from %s\n", resumed, store_path);
+  }
+
+  struct stats stats = { 0 };
+  struct stats_reporter reporter;
+  if (stats_reporter_open(&reporter, stats_path, 1000000) < 0) {
+    exit(EXIT_FAILURE);
+  }
+  uint64_t instructions = 0;
+
+  struct capture capture = { 0 };
+  if (capture_path[0] != '\0' && capture_open(&capture, capture_path) < 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  uint64_t start = now_ns();
+  uint64_t deadline = start;
+
+  for (long f = 0; f < frames; f++) {
+    uint64_t frame_start = now_ns();
+    sched_frame(s);
+    uint64_t frame_end = now_ns();
+
+    // Only frames that drew anything can have changed the display
+    struct machine *first = handles[0]->m;
+    if (first->drawFlag) {
+      capture_frame(&capture, first, f + 1);
+      first->drawFlag = 0;
+    }
+
+    // Viewers' keys land between frames, as the scheduler needs
+    struct stream_key keys[256];
+    stream_frame(&stream, f + 1);
+    int nkeys = stream_poll(&stream, keys, 256);
+    for (int i = 0; i < nkeys; i++) {
+      size_t session = keys[i].session;
+      if (keys[i].down && hibernated(&store, handles, session)) {
+        // A key for a session still in its slot would start it running
+        // from there, so it's dropped and the viewer can press it again
+        if (wake(&store, pool, &image, &stream, handles, session) < 0) {
+          continue;
+        }
+        stats_add(&stats.wakes, 1);
+      }
+      sched_key(s, handles[session], keys[i].key, keys[i].down);
+    }
+
+    // Sessions that have sat waiting on a key for long enough go out to the
+    // store, checked once a second
+    if (store.base != NULL && (f + 1) % 60 == 0) {
+      uint32_t asleep = 0;
+      for (size_t i = 0; i < sessions; i++) {
+        if (hibernated(&store, handles, i)) {
+          asleep++;
+        } else if (handles[i]->parked && s->frame - handles[i]->parked_at >= (uint64_t)idle_frames) {
+          hibernate(&store, pool, &stream, handles, i);
+          asleep++;
+        }
+      }
+      stats_set(&stats.hibernated, asleep);
+    }
+
+    uint64_t total = sched_instructions(s);
+    stats_add(&stats.instructions, total - instructions);
+    stats_add(&stats.frames, 1);
+    stats_set(&stats.cycles_per_frame, total - instructions);
+    stats_record(&stats.frame_us, (frame_end - frame_start) / 1000);
+    stats_report(&reporter, &stats, frame_end / 1000);
+    instructions = total;
+
+    if (realtime) {
+      deadline += FRAME_NS;
+      uint64_t t = now_ns();
+      if (t < deadline) {
+        struct timespec ts = {
+          .tv_sec = (deadline - t) / 1000000000L,
+          .tv_nsec = (deadline - t) % 1000000000L
+        };
+        nanosleep(&ts, NULL);
+      }
+    }
+  }
+
+  double elapsed = (now_ns() - start) / 1e9;
+
+  // Summarise where everything ended up
+  size_t count[MACHINE_STUCK + 1] = { 0 };
+  for (size_t i = 0; i < sessions; i++) {
+    count[s->sessions[i].status]++;
+  }
+
+  uint64_t runs = 0, steals = 0, total = sched_instructions(s);
+  for (int i = 0; i < threads; i++) {
+    runs += s->workers[i].runs;
+    steals += s->workers[i].steals;
+  }
+
+  fprintf(stderr,
+      "%zu sessions, %ld frames in %.3fs (%.0f session frames/s)\n"
+      "running %zu, waiting on key %zu, idle %zu, faulted %zu, halted %zu, stuck %zu\n"
+      "%llu session frames run, %llu stolen\n"
+      "%llu instructions in %.3fs (%.0f/s)\n",
+      sessions, frames, elapsed, runs / elapsed,
+      count[MACHINE_RUNNING], count[MACHINE_WAIT_KEY],
+      count[MACHINE_IDLE], count[MACHINE_FAULT], count[MACHINE_HALTED], count[MACHINE_STUCK],
+      (unsigned long long)runs, (unsigned long long)steals,
+      (unsigned long long)total, elapsed, total / elapsed);
+
+  if (capture_path[0] != '\0') {
+    fprintf(stderr, "Captured %llu frames in %llu bytes\n",
+        (unsigned long long)capture.frames, (unsigned long long)capture.bytes);
+  }
+
+  if (stream_addr[0] != '\0') {
+    fprintf(stderr, "Streamed %llu messages in %llu bytes\n",
+        (unsigned long long)stream.messages, (unsigned long long)stream.bytes);
+  }
+
+  // Everything still awake goes out to the store too, so the lot carries on
+  // from here next time
+  if (store.base != NULL) {
+    for (size_t i = 0; i < sessions; i++) {
+      if (!hibernated(&store, handles, i)) {
+        store_save(&store, i, handles[i]->m, handles[i]->parked ? STORE_PARKED : STORE_RUNNING);
+      }
+    }
+    store_close(&store);
+  }
+
+  capture_close(&capture);
+  stream_close(&stream);
+  free(handles);
+  stats_reporter_close(&reporter);
+  sched_destroy(s);
+  pool_destroy(pool);
+  image_close(&image);
+
+  return 0;
+}
@@ -0,0 +1,79 @@
+//
+// ROM images shared copy-on-write between sessions
+//
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "image.h"
+
+// Builds the image for a ROM of size bytes
+// Returns -1 if it couldn't be made, sessions then load the ROM into their
+// own memory as usual.
+int image_create(struct rom_image *image, const uint8_t *rom, size_t size) {
+  memset(image, 0, sizeof(*image));
+  image->fd = -1;
+
+  // Lay memory out with initialize itself on a scratch machine, so the image
+  // can't drift from what a freshly loaded session would hold
+  struct machine *scratch = aligned_alloc(_Alignof(struct machine), sizeof(struct machine));
+  if (scratch == NULL) {
+    return -1;
+  }
+  memset(scratch, 0, sizeof(*scratch));
+  initialize(scratch, rom, size);
+
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t length = (scratch->mem_top + page - 1) & ~(page - 1);
+  if (length > MEMORY_SIZE) {
+    length = MEMORY_SIZE;
+  }
+
+  int fd = memfd_create("dip-rom", MFD_CLOEXEC);
+  if (fd >= 0 && (ftruncate(fd, length) < 0 || pwrite(fd, scratch->memory, length, 0) != (ssize_t)length)) {
+    close(fd);
+    fd = -1;
+  }
+  free(scratch);
+  if (fd < 0) {
+    return -1;
+  }
+
+  image->fd = fd;
+  image->size = size;
+  image->length = length;
+
+  return 0;
+}
+
+void image_close(struct rom_image *image) {
+  if (image->fd >= 0) {
+    close(image->fd);
+  }
+  image->fd = -1;
+}
+
+// Maps the image over a cleared machine's memory and initializes it
+// The mapping stays until the machine is evicted from its pool. Returns -1,
+// leaving the machine as it was, if there's no image or memory doesn't start
+// on a page boundary on this host.
+int image_map(const struct rom_image *image, struct machine *m) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  if (image->fd < 0 || (uintptr_t)m->memory % page != 0) {
+    return -1;
+  }
+
+  void *p = mmap(m->memory, image->length, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_FIXED, image->fd, 0);
+  if (p == MAP_FAILED) {
+    return -1;
+  }
+
+  initialize_loaded(m, image->size);
+
+  return 0;
+}
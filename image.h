@@ -0,0 +1,25 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+// Shared ROM images
+// Memory as initialize leaves it, fontsets and ROM, is built once per ROM in
+// an anonymous in-memory file. Each session maps it copy-on-write over its own
+// memory, so they all read the same physical pages and a session only gets a
+// private copy of a page once it writes to it, with Fx55, Fx33 and the like.
+struct rom_image {
+  int fd;
+  size_t size;   // Bytes of ROM
+  size_t length; // Bytes of memory the image covers, whole pages
+};
+
+int image_create(struct rom_image *image, const uint8_t *rom, size_t size);
+void image_close(struct rom_image *image);
+
+int image_map(const struct rom_image *image, struct machine *m);
+
+#endif // IMAGE_H
@@ -1,36 +1,131 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <SDL2/SDL.h>
 
 #include "cpu.h"
 
-// Mapping of keys from SDL to our indices
-uint8_t key_map[] = {
-  SDLK_x, SDLK_1, SDLK_2, SDLK_3, // row 1...row n
-  SDLK_q, SDLK_w, SDLK_e, SDLK_a,
-  SDLK_s, SDLK_d, SDLK_z, SDLK_c,
-  SDLK_4, SDLK_r, SDLK_f, SDLK_v
+// Keypad key for every scancode and gamepad button, -1 when there isn't one
+// Scancodes follow where keys are rather than what's printed on them, so the
+// keypad keeps its shape on any layout.
+int8_t scancode_map[SDL_NUM_SCANCODES];
+int8_t button_map[SDL_CONTROLLER_BUTTON_MAX];
+
+// Keypad layout on the left of a QWERTY keyboard
+//   1 2 3 C    1 2 3 4
+//   4 5 6 D    Q W E R
+//   7 8 9 E    A S D F
+//   A 0 B F    Z X C V
+static const SDL_Scancode default_keys[16] = {
+  SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3,
+  SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A,
+  SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z, SDL_SCANCODE_C,
+  SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V
+};
+
+// The D-pad moves around 5 in the middle of the keypad, A presses it
+static const struct {
+  SDL_GameControllerButton button;
+  int8_t key;
+} default_buttons[] = {
+  { SDL_CONTROLLER_BUTTON_DPAD_UP, 0x2 },
+  { SDL_CONTROLLER_BUTTON_DPAD_LEFT, 0x4 },
+  { SDL_CONTROLLER_BUTTON_DPAD_RIGHT, 0x6 },
+  { SDL_CONTROLLER_BUTTON_DPAD_DOWN, 0x8 },
+  { SDL_CONTROLLER_BUTTON_A, 0x5 },
+  { SDL_CONTROLLER_BUTTON_B, 0x0 },
 };
 
-// Runs a lookup over the keys that are pressed
-int lookup_key(SDL_Keycode key) {
+// Sets up the default bindings
+void keypad_init() {
+  memset(scancode_map, -1, sizeof(scancode_map));
+  memset(button_map, -1, sizeof(button_map));
+
   for (int i = 0; i < 16; i++) {
-    if (key_map[i] == key) {
-      return i;
+    scancode_map[default_keys[i]] = i;
+  }
+  for (size_t i = 0; i < sizeof(default_buttons) / sizeof(default_buttons[0]); i++) {
+    button_map[default_buttons[i].button] = default_buttons[i].key;
+  }
+}
+
+// Binds keys and buttons from a comma separated list of [key]=[name]
+// key is a hex digit, name is an SDL scancode name like "Up" or "Keypad 5",
+// or a gamepad button prefixed with "pad:", like "pad:x". Extra bindings go
+// alongside the defaults. Returns -1 if any of them can't be made sense of.
+int keypad_bind(const char *spec) {
+  char buffer[256];
+  strncpy(buffer, spec, sizeof(buffer) - 1);
+  buffer[sizeof(buffer) - 1] = '\0';
+
+  for (char *binding = strtok(buffer, ","); binding != NULL; binding = strtok(NULL, ",")) {
+    char *end;
+    long key = strtol(binding, &end, 16);
+    if (end == binding || *end != '=' || key < 0 || key > 0xF) {
+      return -1;
     }
+
+    const char *name = end + 1;
+    if (!strncmp(name, "pad:", 4)) {
+      SDL_GameControllerButton button = SDL_GameControllerGetButtonFromString(name + 4);
+      if (button == SDL_CONTROLLER_BUTTON_INVALID) {
+        return -1;
+      }
+      button_map[button] = key;
+    } else {
+      SDL_Scancode scancode = SDL_GetScancodeFromName(name);
+      if (scancode == SDL_SCANCODE_UNKNOWN) {
+        return -1;
+      }
+      scancode_map[scancode] = key;
+    }
+  }
+
+  return 0;
+}
+
+// Keypad key for a scancode, -1 if it isn't bound
+int lookup_key(SDL_Scancode scancode) {
+  return (unsigned)scancode < SDL_NUM_SCANCODES ? scancode_map[scancode] : -1;
+}
+
+// Works out which keypad key an event presses or releases
+// Returns the key with down set, or -1 for anything else. Gamepads are
+// opened as they're plugged in.
+int keypad_event(const SDL_Event *e, int *down) {
+  switch (e->type) {
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+      if (e->key.repeat) {
+        return -1;
+      }
+      *down = e->type == SDL_KEYDOWN;
+      return lookup_key(e->key.keysym.scancode);
+
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP:
+      if (e->cbutton.button >= SDL_CONTROLLER_BUTTON_MAX) {
+        return -1;
+      }
+      *down = e->type == SDL_CONTROLLERBUTTONDOWN;
+      return button_map[e->cbutton.button];
+
+    case SDL_CONTROLLERDEVICEADDED:
+      SDL_GameControllerOpen(e->cdevice.which);
+      return -1;
   }
+
   return -1;
 }
 
 // Handle any input events
-void handle_input(SDL_Event e) {
-  int k;
-  switch(e.type) {
-    case SDL_KEYUP:
-      k = lookup_key(e.key.keysym.sym);
-      key[k] = 0;
-      break;
-    case SDL_KEYDOWN:
-      k = lookup_key(e.key.keysym.sym);
-      key[k] = 1;
-      break;
+// Returns the keypad key that changed, or -1 if none did.
+int handle_input(struct machine *m, const SDL_Event *e) {
+  int down;
+  int k = keypad_event(e, &down);
+  if (k >= 0) {
+    m->key[k] = down;
   }
-}
\ No newline at end of file
+  return k;
+}
@@ -1,6 +1,12 @@
 #ifndef KEYPAD_H
 #define KEYPAD_H
 
-void handle_input(SDL_Event);
+struct machine;
 
-#endif // KEYPAD_H
\ No newline at end of file
+void keypad_init();
+int keypad_bind(const char *spec);
+int lookup_key(SDL_Scancode scancode);
+int keypad_event(const SDL_Event *e, int *down);
+int handle_input(struct machine *m, const SDL_Event *e);
+
+#endif // KEYPAD_H
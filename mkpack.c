@@ -0,0 +1,119 @@
+//
+// Builds a ROM pack out of a set of ROM files
+//
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "rom.h"
+
+struct pack_rom {
+  struct rompack_entry entry;
+  uint8_t data[ROM_MAX];
+};
+
+// Usage instructions for the pack builder
+int print_usage() {
+  printf(
+"Usage: dip-pack -o [path_to_pack] [-q quirks] [path_to_rom...]\n\n"
+"  -o [path_to_pack]      Write the pack to path\n"
+"  -q [quirks]            Quirk profile for the ROMs that follow, in hex\n");
+
+  exit(EXIT_SUCCESS);
+}
+
+static int compare_names(const void *a, const void *b) {
+  const struct pack_rom *ra = a;
+  const struct pack_rom *rb = b;
+  return strcmp(ra->entry.name, rb->entry.name);
+}
+
+int main(int argc, char **argv) {
+
+  char *pack_path = NULL;
+  uint32_t quirks = 0;
+
+  struct pack_rom *roms = calloc(argc, sizeof(*roms));
+  uint32_t count = 0;
+
+  // Parse arguments, loading ROMs as we go
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "-q")) {
+      if (i == argc-1) {
+        print_usage();
+      }
+      if (argv[i][1] == 'o') {
+        pack_path = argv[++i];
+      } else {
+        quirks = strtoul(argv[++i], NULL, 16);
+      }
+      continue;
+    }
+
+    struct pack_rom *rom = &roms[count++];
+
+    // ROMs are named after their file, without any directories
+    const char *name = strrchr(argv[i], '/');
+    name = name ? name + 1 : argv[i];
+    if (strlen(name) >= sizeof(rom->entry.name)) {
+      fprintf(stderr, "ROM name too long: %s\n", name);
+      exit(EXIT_FAILURE);
+    }
+
+    strcpy(rom->entry.name, name);
+    rom->entry.size = load_rom(rom->data, argv[i]);
+    rom->entry.hash = rom_hash(rom->data, rom->entry.size);
+    rom->entry.quirks = quirks;
+  }
+
+  if (pack_path == NULL || count == 0) {
+    print_usage();
+  }
+
+  qsort(roms, count, sizeof(*roms), compare_names);
+
+  // Lay the ROMs out one after another after the index
+  uint32_t offset = sizeof(struct rompack_header) + count * sizeof(struct rompack_entry);
+  for (uint32_t i = 0; i < count; i++) {
+    if (i > 0 && !strcmp(roms[i].entry.name, roms[i - 1].entry.name)) {
+      fprintf(stderr, "Duplicate ROM name: %s\n", roms[i].entry.name);
+      exit(EXIT_FAILURE);
+    }
+    roms[i].entry.offset = offset;
+    offset += roms[i].entry.size;
+  }
+
+  FILE *fp = fopen(pack_path, "wb");
+  if (fp == NULL) {
+    fprintf(stderr, "Couldn't open %s for writing\n", pack_path);
+    exit(EXIT_FAILURE);
+  }
+
+  struct rompack_header header = {
+    .magic = ROMPACK_MAGIC,
+    .version = ROMPACK_VERSION,
+    .count = count
+  };
+  fwrite(&header, sizeof(header), 1, fp);
+
+  for (uint32_t i = 0; i < count; i++) {
+    fwrite(&roms[i].entry, sizeof(roms[i].entry), 1, fp);
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    fwrite(roms[i].data, 1, roms[i].entry.size, fp);
+  }
+
+  if (fclose(fp) != 0) {
+    fprintf(stderr, "Couldn't write %s\n", pack_path);
+    exit(EXIT_FAILURE);
+  }
+
+  printf("Packed %u ROMs into %s (%u bytes)\n", count, pack_path, offset);
+
+  free(roms);
+
+  return 0;
+}
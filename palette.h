@@ -0,0 +1,24 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <stdint.h>
+
+// Colours every frontend draws each combination of the two bitplanes in, as
+// ARGB: neither, the first plane, the second, and both
+static const uint32_t palette[4] = {
+  0xFF000000, 0xFF00FF00, 0xFFFFA000, 0xFFFFFFFF
+};
+
+static inline uint8_t palette_red(int colour) {
+  return palette[colour] >> 16;
+}
+
+static inline uint8_t palette_green(int colour) {
+  return palette[colour] >> 8;
+}
+
+static inline uint8_t palette_blue(int colour) {
+  return palette[colour];
+}
+
+#endif // PALETTE_H
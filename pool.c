@@ -0,0 +1,116 @@
+/*
+
+Pooled allocator for machine instances
+
+All machines live back to back in one slab so thousands of sessions can be
+created and thrown away without a malloc per instance.
+
+*/
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pool.h"
+
+// Creates a pool with room for capacity machines
+// Returns NULL if the slab couldn't be allocated.
+struct machine_pool *pool_create(size_t capacity) {
+  if (capacity == 0 || capacity > UINT32_MAX) {
+    return NULL;
+  }
+
+  struct machine_pool *pool = malloc(sizeof(*pool));
+  if (pool == NULL) {
+    return NULL;
+  }
+
+  // The slab is mapped straight from the OS, so pages for machines that are
+  // never acquired, or memory a ROM never writes, are never made resident
+  size_t page = sysconf(_SC_PAGESIZE);
+  pool->stride = (sizeof(struct machine) + page - 1) & ~(page - 1);
+  pool->slab = mmap(NULL, capacity * pool->stride, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  pool->free_list = malloc(capacity * sizeof(uint32_t));
+  if (pool->slab == MAP_FAILED || pool->free_list == NULL) {
+    if (pool->slab != MAP_FAILED) {
+      munmap(pool->slab, capacity * pool->stride);
+    }
+    free(pool->free_list);
+    free(pool);
+    return NULL;
+  }
+
+  pool->capacity = capacity;
+  pool_release_all(pool);
+
+  return pool;
+}
+
+// Frees the pool and every machine in it in one go
+void pool_destroy(struct machine_pool *pool) {
+  if (pool == NULL) {
+    return;
+  }
+  munmap(pool->slab, pool->capacity * pool->stride);
+  free(pool->free_list);
+  free(pool);
+}
+
+// Hands out a zeroed machine, or NULL if the pool is exhausted
+struct machine *pool_acquire(struct machine_pool *pool) {
+  if (pool->free_count == 0) {
+    return NULL;
+  }
+
+  struct machine *m = pool_machine(pool, pool->free_list[--pool->free_count]);
+  clear_machine(m);
+
+  return m;
+}
+
+// Returns a machine to the pool
+void pool_release(struct machine_pool *pool, struct machine *m) {
+  pool->free_list[pool->free_count++] = (uint32_t)pool_index(pool, m);
+}
+
+// Returns a machine to the pool and hands its pages back to the OS, they
+// come back zeroed when it's next acquired
+// Fresh pages are mapped over it rather than just dropped, which also gets rid
+// of a ROM image mapped over its memory: dropped pages of that would come
+// back as the ROM again rather than zeroed.
+void pool_evict(struct machine_pool *pool, struct machine *m) {
+  void *p = mmap(m, pool->stride, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+
+  // Out of mappings, say. Its pages stay resident, cleared by hand so it
+  // still comes back zeroed, image or not.
+  if (p == MAP_FAILED) {
+    clear_machine(m);
+  }
+  pool_release(pool, m);
+}
+
+// Acquires up to n machines, returning how many were handed out
+size_t pool_acquire_bulk(struct machine_pool *pool, struct machine **out, size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++) {
+    out[i] = pool_acquire(pool);
+    if (out[i] == NULL) {
+      break;
+    }
+  }
+  return i;
+}
+
+// Returns every machine to the pool at once
+// Lowest indices are handed out first so a partly used pool stays dense.
+void pool_release_all(struct machine_pool *pool) {
+  for (size_t i = 0; i < pool->capacity; i++) {
+    pool->free_list[i] = (uint32_t)(pool->capacity - 1 - i);
+  }
+  pool->free_count = pool->capacity;
+}
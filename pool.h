@@ -0,0 +1,38 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "cpu.h"
+
+// Pool of machines carved out of a single page-aligned slab
+// Acquiring and releasing a machine never touches the heap, the slab and the
+// free list are allocated once up front when the pool is created. Machines
+// start a whole number of pages apart, so one can hand its pages back to the
+// OS without touching its neighbours.
+struct machine_pool {
+  uint8_t *slab;
+  size_t stride;
+  uint32_t *free_list;
+  size_t capacity;
+  size_t free_count;
+};
+
+struct machine_pool *pool_create(size_t capacity);
+void pool_destroy(struct machine_pool *pool);
+
+struct machine *pool_acquire(struct machine_pool *pool);
+void pool_release(struct machine_pool *pool, struct machine *m);
+void pool_evict(struct machine_pool *pool, struct machine *m);
+
+size_t pool_acquire_bulk(struct machine_pool *pool, struct machine **out, size_t n);
+void pool_release_all(struct machine_pool *pool);
+
+// Index of a machine within its pool, handy as a stable session id
+static inline size_t pool_index(const struct machine_pool *pool, const struct machine *m) {
+  return (size_t)((const uint8_t *)m - pool->slab) / pool->stride;
+}
+
+static inline struct machine *pool_machine(const struct machine_pool *pool, size_t i) {
+  return (struct machine *)(pool->slab + i * pool->stride);
+}
+
+#endif // POOL_H
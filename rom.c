@@ -0,0 +1,183 @@
+//
+// Loading of ROM images from disk
+//
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cpu.h"
+#include "rom.h"
+
+// Reads a ROM from disk into buffer, which must have room for ROM_MAX bytes
+// Returns the number of bytes read, or -1 with a message on stderr if the
+// file can't be read or won't fit in memory.
+long read_rom(uint8_t *buffer, const char *rom_path) {
+  FILE *fp = NULL;
+
+  fp = fopen(rom_path, "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "Doesn't appear to be a file hombre. Try another one\n");
+    return -1;
+  }
+
+  size_t read_bytes = fread(buffer, 1, ROM_MAX, fp);
+
+  // Anything left over won't fit in memory
+  int too_big = fgetc(fp) != EOF;
+
+  // Close the ROM file
+  fclose(fp);
+
+  if (too_big) {
+    fprintf(stderr, "ROM is bigger than the %d bytes of memory available\n", ROM_MAX);
+    return -1;
+  }
+
+  return read_bytes;
+}
+
+// Main function to load a ROM
+// Exits if the ROM can't be loaded.
+size_t load_rom(uint8_t *buffer, char *rom_path) {
+  long read_bytes = read_rom(buffer, rom_path);
+  if (read_bytes < 0) {
+    exit(2);
+  }
+  return read_bytes;
+}
+
+// Gets hold of a ROM from a pack if pack_path is set, otherwise from disk
+// The pack is mapped on first use and left open for later lookups. Pack ROMs
+// are used in place from the mapping, ROMs on disk are read into buffer,
+// which must have room for ROM_MAX bytes. Returns NULL if the ROM can't be
+// found.
+const uint8_t *find_rom(struct rompack *pack, const char *pack_path, const char *rom_path,
+    uint8_t *buffer, size_t *size) {
+  if (pack_path == NULL || pack_path[0] == '\0') {
+    long read_bytes = read_rom(buffer, rom_path);
+    if (read_bytes < 0) {
+      return NULL;
+    }
+    *size = read_bytes;
+    return buffer;
+  }
+
+  if (pack->base == NULL && rompack_open(pack, pack_path) < 0) {
+    fprintf(stderr, "Couldn't open ROM pack %s\n", pack_path);
+    return NULL;
+  }
+
+  const struct rompack_entry *e = rompack_find(pack, rom_path);
+  if (e == NULL) {
+    fprintf(stderr, "No ROM called %s in %s\n", rom_path, pack_path);
+    return NULL;
+  }
+
+  *size = e->size;
+  return rompack_data(pack, e);
+}
+
+// 64-bit FNV-1a hash of a ROM's contents
+uint64_t rom_hash(const uint8_t *data, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= data[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// Maps a ROM pack into memory and checks its index
+// Returns 0 on success, -1 if the file can't be mapped or isn't a valid pack.
+int rompack_open(struct rompack *pack, const char *path) {
+  memset(pack, 0, sizeof(*pack));
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct rompack_header)) {
+    close(fd);
+    return -1;
+  }
+
+  void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return -1;
+  }
+
+  pack->base = base;
+  pack->length = st.st_size;
+
+  const struct rompack_header *header = base;
+  if (memcmp(header->magic, ROMPACK_MAGIC, sizeof(ROMPACK_MAGIC)) ||
+      header->version != ROMPACK_VERSION ||
+      header->count > (pack->length - sizeof(*header)) / sizeof(struct rompack_entry)) {
+    rompack_close(pack);
+    return -1;
+  }
+
+  pack->entries = (const struct rompack_entry *)(header + 1);
+  pack->count = header->count;
+
+  // Make sure nothing points outside the file or is too big to load
+  for (uint32_t i = 0; i < pack->count; i++) {
+    const struct rompack_entry *e = &pack->entries[i];
+    if (e->size > ROM_MAX || e->offset > pack->length ||
+        e->size > pack->length - e->offset ||
+        memchr(e->name, '\0', sizeof(e->name)) == NULL) {
+      rompack_close(pack);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+void rompack_close(struct rompack *pack) {
+  if (pack->base != NULL) {
+    munmap((void *)pack->base, pack->length);
+  }
+  memset(pack, 0, sizeof(*pack));
+}
+
+// Looks up a ROM by name, or NULL if it isn't in the pack
+const struct rompack_entry *rompack_find(const struct rompack *pack, const char *name) {
+  uint32_t lo = 0;
+  uint32_t hi = pack->count;
+
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(name, pack->entries[mid].name);
+    if (cmp == 0) {
+      return &pack->entries[mid];
+    }
+    if (cmp < 0) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+
+  return NULL;
+}
+
+// Looks up a ROM by the hash of its contents, or NULL if it isn't in the pack
+const struct rompack_entry *rompack_find_hash(const struct rompack *pack, uint64_t hash) {
+  for (uint32_t i = 0; i < pack->count; i++) {
+    if (pack->entries[i].hash == hash) {
+      return &pack->entries[i];
+    }
+  }
+  return NULL;
+}
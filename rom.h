@@ -0,0 +1,55 @@
+#ifndef ROM_H
+#define ROM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ROM packs
+// A pack is a single file holding many ROMs behind a sorted index, it's
+// mapped into memory once and ROMs are copied straight out of the mapping.
+#define ROMPACK_MAGIC "DIPPACK"
+#define ROMPACK_VERSION 1
+
+struct rompack_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t count;
+};
+
+// Index entry, entries are sorted by name
+struct rompack_entry {
+  char name[32];
+  uint64_t hash;
+  uint32_t offset;
+  uint32_t size;
+  // Quirk profile the ROM expects, opaque to the pack
+  uint32_t quirks;
+  uint32_t reserved;
+};
+
+struct rompack {
+  const uint8_t *base;
+  size_t length;
+  const struct rompack_entry *entries;
+  uint32_t count;
+};
+
+long read_rom(uint8_t *buffer, const char *rom_path);
+size_t load_rom(uint8_t *buffer, char *rom_path);
+const uint8_t *find_rom(struct rompack *pack, const char *pack_path, const char *rom_path,
+    uint8_t *buffer, size_t *size);
+
+uint64_t rom_hash(const uint8_t *data, size_t size);
+
+int rompack_open(struct rompack *pack, const char *path);
+void rompack_close(struct rompack *pack);
+
+const struct rompack_entry *rompack_find(const struct rompack *pack, const char *name);
+const struct rompack_entry *rompack_find_hash(const struct rompack *pack, uint64_t hash);
+
+// Where an entry's ROM lives in the mapping
+static inline const uint8_t *rompack_data(const struct rompack *pack, const struct rompack_entry *e) {
+  return pack->base + e->offset;
+}
+
+#endif // ROM_H
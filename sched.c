@@ -0,0 +1,356 @@
+/*
+
+Cooperative scheduler for hosting many machines per thread
+
+Every frame each worker runs the sessions on its own run-queue, then steals
+from the other workers once it runs dry. Sessions blocked in Fx0A are parked
+off the run-queues entirely until a key wakes them.
+
+*/
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "sched.h"
+
+// Most sessions taken from another worker in one go
+#define STEAL_BATCH 32
+
+// Run-queue helpers
+
+// Slots before the head are never reused until the queue empties, so it's
+// rewound then. Workers only push onto their own queue once it's run dry, and
+// a session is only ever on one queue, so it can't outgrow the sessions.
+static void queue_push(struct sched_queue *q, struct session *se) {
+  pthread_mutex_lock(&q->lock);
+  if (q->head == q->tail) {
+    q->head = q->tail = 0;
+  }
+  q->items[q->tail++] = se;
+  pthread_mutex_unlock(&q->lock);
+}
+
+static struct session *queue_pop(struct sched_queue *q) {
+  struct session *se = NULL;
+
+  pthread_mutex_lock(&q->lock);
+  if (q->tail > q->head) {
+    se = q->items[--q->tail];
+  }
+  pthread_mutex_unlock(&q->lock);
+
+  return se;
+}
+
+// Takes up to half of a queue from the head
+static size_t queue_steal(struct sched_queue *q, struct session **out) {
+  size_t n = 0;
+
+  pthread_mutex_lock(&q->lock);
+  size_t len = q->tail - q->head;
+  n = (len + 1) / 2;
+  if (n > STEAL_BATCH) {
+    n = STEAL_BATCH;
+  }
+  memcpy(out, &q->items[q->head], n * sizeof(*out));
+  q->head += n;
+  pthread_mutex_unlock(&q->lock);
+
+  return n;
+}
+
+// Refills a worker's queue with the sessions it ran last frame
+static void queue_reset(struct sched_worker *w) {
+  struct sched_queue *q = &w->ready;
+
+  memcpy(q->items, w->next, w->next_count * sizeof(*w->next));
+  q->head = 0;
+  q->tail = w->next_count;
+  w->next_count = 0;
+}
+
+// Tries to pull work over from the other workers
+static struct session *steal(struct sched_worker *w) {
+  struct session *batch[STEAL_BATCH];
+  struct sched *s = w->s;
+
+  for (int i = 1; i < s->nworkers; i++) {
+    struct sched_worker *victim = &s->workers[(w->id + i) % s->nworkers];
+    size_t n = queue_steal(&victim->ready, batch);
+    if (n == 0) {
+      continue;
+    }
+
+    w->steals += n;
+
+    // Keep one to run now, the rest go on our own queue
+    for (size_t j = 1; j < n; j++) {
+      queue_push(&w->ready, batch[j]);
+    }
+    return batch[0];
+  }
+
+  return NULL;
+}
+
+// Runs a single session for one frame
+static void run_session(struct sched_worker *w, struct session *se) {
+  if (!se->active) {
+    return;
+  }
+
+  uint64_t cycles = se->m->cycles;
+  se->status = run_frame(se->m, se->budget);
+  se->home = w->id;
+  w->runs++;
+  w->instructions += se->m->cycles - cycles;
+
+  switch (se->status) {
+    case MACHINE_WAIT_KEY:
+      // Nothing to do until a key goes down
+      se->parked = 1;
+      se->parked_at = w->s->frame;
+      break;
+
+    case MACHINE_FAULT:
+    case MACHINE_HALTED:
+    case MACHINE_STUCK:
+      // Dropped from the run-queues, the owner can see why from its status
+      break;
+
+    default:
+      w->next[w->next_count++] = se;
+      break;
+  }
+}
+
+static void *worker_main(void *arg) {
+  struct sched_worker *w = arg;
+  struct sched *s = w->s;
+  uint64_t seen = 0;
+
+  for (;;) {
+    pthread_mutex_lock(&s->lock);
+    while (s->generation == seen && !s->quit) {
+      pthread_cond_wait(&s->start, &s->lock);
+    }
+    if (s->quit) {
+      pthread_mutex_unlock(&s->lock);
+      break;
+    }
+    seen = s->generation;
+    pthread_mutex_unlock(&s->lock);
+
+    struct session *se;
+    while ((se = queue_pop(&w->ready)) != NULL || (se = steal(w)) != NULL) {
+      run_session(w, se);
+    }
+
+    pthread_mutex_lock(&s->lock);
+    if (--s->pending == 0) {
+      pthread_cond_signal(&s->done);
+    }
+    pthread_mutex_unlock(&s->lock);
+  }
+
+  return NULL;
+}
+
+// Stops the first started workers and frees everything
+static void teardown(struct sched *s, int started) {
+  pthread_mutex_lock(&s->lock);
+  s->quit = 1;
+  pthread_cond_broadcast(&s->start);
+  pthread_mutex_unlock(&s->lock);
+
+  for (int i = 0; i < s->nworkers; i++) {
+    struct sched_worker *w = &s->workers[i];
+    if (i < started) {
+      pthread_join(w->thread, NULL);
+    }
+    pthread_mutex_destroy(&w->ready.lock);
+    free(w->ready.items);
+    free(w->next);
+  }
+
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->start);
+  pthread_cond_destroy(&s->done);
+
+  free(s->workers);
+  free(s->sessions);
+  free(s->free_list);
+  free(s);
+}
+
+// Creates a scheduler with nworkers threads and room for capacity sessions
+// Returns NULL if anything couldn't be allocated or a thread wouldn't start.
+struct sched *sched_create(int nworkers, size_t capacity) {
+  if (nworkers < 1 || capacity == 0) {
+    return NULL;
+  }
+
+  struct sched *s = calloc(1, sizeof(*s));
+  if (s == NULL) {
+    return NULL;
+  }
+
+  s->nworkers = nworkers;
+  s->capacity = capacity;
+  s->sessions = calloc(capacity, sizeof(*s->sessions));
+  s->free_list = malloc(capacity * sizeof(*s->free_list));
+  s->workers = calloc(nworkers, sizeof(*s->workers));
+  if (s->sessions == NULL || s->free_list == NULL || s->workers == NULL) {
+    free(s->sessions);
+    free(s->free_list);
+    free(s->workers);
+    free(s);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < capacity; i++) {
+    s->free_list[i] = capacity - 1 - i;
+  }
+  s->free_count = capacity;
+
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->start, NULL);
+  pthread_cond_init(&s->done, NULL);
+
+  // Any worker may end up holding every session after stealing
+  int ok = 1;
+  for (int i = 0; i < nworkers; i++) {
+    struct sched_worker *w = &s->workers[i];
+    w->s = s;
+    w->id = i;
+    w->ready.items = malloc(capacity * sizeof(*w->ready.items));
+    w->next = malloc(capacity * sizeof(*w->next));
+    pthread_mutex_init(&w->ready.lock, NULL);
+    ok = ok && w->ready.items != NULL && w->next != NULL;
+  }
+
+  // A worker that never started would leave sched_frame waiting on it forever
+  int started = 0;
+  while (ok && started < nworkers) {
+    struct sched_worker *w = &s->workers[started];
+    if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+      break;
+    }
+    started++;
+  }
+  if (started < nworkers) {
+    teardown(s, started);
+    return NULL;
+  }
+
+  return s;
+}
+
+void sched_destroy(struct sched *s) {
+  if (s == NULL) {
+    return;
+  }
+  teardown(s, s->nworkers);
+}
+
+// Starts hosting a machine, spreading new sessions across the workers
+// Returns NULL if the scheduler is full.
+struct session *sched_add(struct sched *s, struct machine *m, uint32_t budget) {
+  if (s->free_count == 0) {
+    return NULL;
+  }
+
+  struct session *se = &s->sessions[s->free_list[--s->free_count]];
+  memset(se, 0, sizeof(*se));
+  se->m = m;
+  se->budget = budget;
+  se->status = m->status;
+  se->active = 1;
+  se->home = s->next_worker;
+
+  s->next_worker = (s->next_worker + 1) % s->nworkers;
+  queue_push(&s->workers[se->home].ready, se);
+
+  return se;
+}
+
+// Pulls a session off whichever run-queue it's sat on
+static void unqueue(struct sched *s, struct session *se) {
+  for (int i = 0; i < s->nworkers && !se->parked; i++) {
+    struct sched_queue *q = &s->workers[i].ready;
+    for (size_t j = q->head; j < q->tail; j++) {
+      if (q->items[j] == se) {
+        q->items[j] = q->items[--q->tail];
+        return;
+      }
+    }
+  }
+}
+
+// Stops hosting a session
+void sched_remove(struct sched *s, struct session *se) {
+  // Pull it off the run-queues so the slot can be reused
+  unqueue(s, se);
+
+  se->active = 0;
+  se->parked = 0;
+  s->free_list[s->free_count++] = se - s->sessions;
+}
+
+// Parks a session until a key wakes it, as if it had blocked on one
+void sched_park(struct sched *s, struct session *se) {
+  unqueue(s, se);
+
+  se->parked = 1;
+  se->parked_at = s->frame;
+  se->status = MACHINE_WAIT_KEY;
+}
+
+// Delivers a key event to a session, waking it if it was blocked on a key
+void sched_key(struct sched *s, struct session *se, uint8_t k, int down) {
+  struct machine *m = se->m;
+
+  m->key[k & 0xF] = down ? 1 : 0;
+
+  if (!down || !se->parked) {
+    return;
+  }
+
+  // Timers kept counting while it was parked
+  uint64_t elapsed = s->frame - se->parked_at;
+  m->delay_timer = elapsed < m->delay_timer ? m->delay_timer - elapsed : 0;
+  m->sound_timer = elapsed < m->sound_timer ? m->sound_timer - elapsed : 0;
+
+  se->parked = 0;
+  se->status = MACHINE_RUNNING;
+  queue_push(&s->workers[se->home].ready, se);
+}
+
+// Runs one frame of every runnable session, returning once they're all done
+void sched_frame(struct sched *s) {
+  pthread_mutex_lock(&s->lock);
+  s->frame++;
+  s->generation++;
+  s->pending = s->nworkers;
+  pthread_cond_broadcast(&s->start);
+  while (s->pending > 0) {
+    pthread_cond_wait(&s->done, &s->lock);
+  }
+  pthread_mutex_unlock(&s->lock);
+
+  // Everything that ran goes round again next frame on the worker that ran it
+  for (int i = 0; i < s->nworkers; i++) {
+    queue_reset(&s->workers[i]);
+  }
+}
+
+// Instructions run across every worker since creation
+// Workers are idle between frames, so their counters can be read as is.
+uint64_t sched_instructions(const struct sched *s) {
+  uint64_t total = 0;
+  for (int i = 0; i < s->nworkers; i++) {
+    total += s->workers[i].instructions;
+  }
+  return total;
+}
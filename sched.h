@@ -0,0 +1,97 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <pthread.h>
+
+#include "cpu.h"
+
+// A long lived machine hosted by the scheduler
+struct session {
+  struct machine *m;
+
+  // Most instructions the session may run in a single frame
+  uint32_t budget;
+
+  // Status from the last frame the session ran
+  uint8_t status;
+
+  // Whether the session is in use, and whether it's off the run-queue
+  // blocked on a key
+  uint8_t active;
+  uint8_t parked;
+
+  // Frame the session parked on, so timers can catch up when it wakes
+  uint64_t parked_at;
+
+  // Worker that ran it last, it goes back there when woken
+  int home;
+};
+
+// Run-queue of a single worker
+// The owner pops from the tail, thieves take from the head.
+struct sched_queue {
+  pthread_mutex_t lock;
+  struct session **items;
+  size_t head;
+  size_t tail;
+};
+
+struct sched;
+
+struct sched_worker {
+  struct sched *s;
+  pthread_t thread;
+  int id;
+
+  // Sessions to run this frame
+  struct sched_queue ready;
+
+  // Sessions that ran this frame and go round again next frame
+  struct session **next;
+  size_t next_count;
+
+  // Sessions run, stolen from other workers, and instructions run, since
+  // creation
+  uint64_t runs;
+  uint64_t steals;
+  uint64_t instructions;
+};
+
+// Cooperative scheduler multiplexing many sessions over a few threads
+// Time is sliced in 60Hz frames, every runnable session gets one frame of at
+// most its budget per call to sched_frame.
+struct sched {
+  struct sched_worker *workers;
+  int nworkers;
+
+  struct session *sessions;
+  size_t *free_list;
+  size_t capacity;
+  size_t free_count;
+  int next_worker;
+
+  // Frames run so far
+  uint64_t frame;
+
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  uint64_t generation;
+  int pending;
+  int quit;
+};
+
+struct sched *sched_create(int nworkers, size_t capacity);
+void sched_destroy(struct sched *s);
+
+// These must only be called between frames, from the thread that calls
+// sched_frame
+struct session *sched_add(struct sched *s, struct machine *m, uint32_t budget);
+void sched_remove(struct sched *s, struct session *se);
+void sched_park(struct sched *s, struct session *se);
+void sched_key(struct sched *s, struct session *se, uint8_t k, int down);
+
+void sched_frame(struct sched *s);
+uint64_t sched_instructions(const struct sched *s);
+
+#endif // SCHED_H
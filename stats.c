@@ -0,0 +1,138 @@
+//
+// Runtime metrics, dumped as JSON lines
+//
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "stats.h"
+
+// Adds a sample to the bucket for its power of two
+void stats_record(struct stats_histogram *h, uint64_t us) {
+  int b = 63 - __builtin_clzll(us | 1);
+  if (b >= STATS_BUCKETS) {
+    b = STATS_BUCKETS - 1;
+  }
+  atomic_fetch_add_explicit(&h->bucket[b], 1, memory_order_relaxed);
+}
+
+static uint64_t load(const _Atomic uint64_t *counter) {
+  return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+// Appends a histogram as a JSON array
+static size_t format_histogram(const struct stats_histogram *h, char *buf, size_t size) {
+  size_t n = snprintf(buf, size, "[");
+  for (int i = 0; i < STATS_BUCKETS && n < size; i++) {
+    n += snprintf(buf + n, size - n, i ? ",%llu" : "%llu",
+        (unsigned long long)load(&h->bucket[i]));
+  }
+  if (n < size) {
+    n += snprintf(buf + n, size - n, "]");
+  }
+  return n;
+}
+
+// Writes the stats out as a single line of JSON
+// Rates are worked out over the time since the reporter last reported.
+size_t stats_format(const struct stats *s, const struct stats_reporter *r,
+    uint64_t now_us, char *buf, size_t size) {
+  uint64_t instructions = load(&s->instructions);
+  uint64_t frames = load(&s->frames);
+  double dt = (now_us - r->last_us) / 1e6;
+  if (dt <= 0) {
+    dt = 1;
+  }
+
+  size_t n = snprintf(buf, size,
+      "{\"t_us\":%llu,\"instructions\":%llu,\"ips\":%.0f,\"frames\":%llu,"
+      "\"fps\":%.1f,\"cycles_per_frame\":%u,\"presents\":%llu,"
+      "\"presents_skipped\":%llu,\"audio_queued\":%u,\"audio_underruns\":%llu,"
+      "\"input_events\":%llu,\"hibernated\":%u,\"wakes\":%llu",
+      (unsigned long long)now_us, (unsigned long long)instructions,
+      (instructions - r->last_instructions) / dt, (unsigned long long)frames,
+      (frames - r->last_frames) / dt,
+      atomic_load_explicit(&s->cycles_per_frame, memory_order_relaxed),
+      (unsigned long long)load(&s->presents),
+      (unsigned long long)load(&s->presents_skipped),
+      atomic_load_explicit(&s->audio_queued, memory_order_relaxed),
+      (unsigned long long)load(&s->audio_underruns),
+      (unsigned long long)load(&s->input_events),
+      atomic_load_explicit(&s->hibernated, memory_order_relaxed),
+      (unsigned long long)load(&s->wakes));
+
+  const struct {
+    const char *name;
+    const struct stats_histogram *h;
+  } histograms[] = {
+    { "frame_us", &s->frame_us },
+    { "present_us", &s->present_us },
+    { "filter_us", &s->filter_us },
+    { "input_latency_us", &s->input_latency_us },
+  };
+
+  for (size_t i = 0; i < sizeof(histograms) / sizeof(histograms[0]) && n < size; i++) {
+    n += snprintf(buf + n, size - n, ",\"%s\":", histograms[i].name);
+    if (n < size) {
+      n += format_histogram(histograms[i].h, buf + n, size - n);
+    }
+  }
+
+  if (n < size) {
+    n += snprintf(buf + n, size - n, "}\n");
+  }
+
+  return n < size ? n : size - 1;
+}
+
+// Starts reporting to path every interval_us, "-" means stderr
+// Returns -1 if the file couldn't be opened.
+int stats_reporter_open(struct stats_reporter *r, const char *path, uint64_t interval_us) {
+  memset(r, 0, sizeof(*r));
+  r->interval_us = interval_us;
+
+  if (path == NULL || path[0] == '\0') {
+    return 0;
+  }
+
+  r->out = strcmp(path, "-") ? fopen(path, "a") : stderr;
+  if (r->out == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  return 0;
+}
+
+void stats_reporter_close(struct stats_reporter *r) {
+  if (r->out != NULL && r->out != stderr) {
+    fclose(r->out);
+  }
+  r->out = NULL;
+}
+
+// Writes a line if the interval has passed since the last one
+void stats_report(struct stats_reporter *r, const struct stats *s, uint64_t now_us) {
+  if (r->out == NULL) {
+    return;
+  }
+
+  if (r->last_us == 0) {
+    r->last_us = now_us;
+    return;
+  }
+
+  if (now_us - r->last_us < r->interval_us) {
+    return;
+  }
+
+  char line[1024];
+  stats_format(s, r, now_us, line, sizeof(line));
+  fputs(line, r->out);
+  fflush(r->out);
+
+  r->last_us = now_us;
+  r->last_instructions = load(&s->instructions);
+  r->last_frames = load(&s->frames);
+}
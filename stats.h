@@ -0,0 +1,73 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Histograms bucket by powers of two in microseconds, the last bucket takes
+// everything from ~32ms up
+#define STATS_BUCKETS 16
+
+struct stats_histogram {
+  _Atomic uint64_t bucket[STATS_BUCKETS];
+};
+
+// Runtime counters
+// Written by the thread running the machine once per frame or present, never
+// per instruction. Every field is atomic so the block can be read from
+// anywhere without taking a lock.
+struct stats {
+  // Emulation
+  _Atomic uint64_t instructions;
+  _Atomic uint64_t frames;
+  _Atomic uint32_t cycles_per_frame;
+  struct stats_histogram frame_us;
+
+  // Display
+  _Atomic uint64_t presents;
+  _Atomic uint64_t presents_skipped;
+  struct stats_histogram present_us;
+  struct stats_histogram filter_us;
+
+  // Audio
+  _Atomic uint32_t audio_queued;
+  _Atomic uint64_t audio_underruns;
+
+  // Input
+  _Atomic uint64_t input_events;
+  struct stats_histogram input_latency_us;
+
+  // Sessions hibernated to a store, and woken from it
+  _Atomic uint32_t hibernated;
+  _Atomic uint64_t wakes;
+};
+
+// Periodic JSON lines output, remembering enough to work out rates
+struct stats_reporter {
+  FILE *out;
+  uint64_t interval_us;
+  uint64_t last_us;
+  uint64_t last_instructions;
+  uint64_t last_frames;
+};
+
+static inline void stats_add(_Atomic uint64_t *counter, uint64_t n) {
+  atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+static inline void stats_set(_Atomic uint32_t *gauge, uint32_t value) {
+  atomic_store_explicit(gauge, value, memory_order_relaxed);
+}
+
+void stats_record(struct stats_histogram *h, uint64_t us);
+
+size_t stats_format(const struct stats *s, const struct stats_reporter *r,
+    uint64_t now_us, char *buf, size_t size);
+
+int stats_reporter_open(struct stats_reporter *r, const char *path, uint64_t interval_us);
+void stats_reporter_close(struct stats_reporter *r);
+void stats_report(struct stats_reporter *r, const struct stats *s, uint64_t now_us);
+
+#endif // STATS_H
@@ -0,0 +1,131 @@
+//
+// Hibernation of idle sessions to a memory-mapped file
+//
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "store.h"
+
+// Bytes of a machine that need copying, memory above mem_top is all zero
+static size_t machine_bytes(const struct machine *m) {
+  uint32_t top = m->mem_top > MEMORY_SIZE ? MEMORY_SIZE : m->mem_top;
+  return offsetof(struct machine, memory) + top;
+}
+
+// Opens the store at path with room for count sessions, creating it if needs
+// be, for sessions of the ROM with hash rom
+// Sessions already in an existing store are left there to be picked up.
+// Returns 0 on success, -1 if it can't be mapped or was written for another
+// ROM or build.
+int store_open(struct store *st, const char *path, size_t count, uint64_t rom) {
+  memset(st, 0, sizeof(*st));
+  st->page_size = sysconf(_SC_PAGESIZE);
+  st->slot_size = (sizeof(struct store_slot) + st->page_size - 1) & ~(st->page_size - 1);
+
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct stat sb;
+  if (fstat(fd, &sb) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  // A new store or more sessions than last time grow the file, the new
+  // slots read back as zero and so empty
+  int fresh = sb.st_size == 0;
+  size_t length = st->page_size + count * st->slot_size;
+  if ((size_t)sb.st_size < length && ftruncate(fd, length) < 0) {
+    close(fd);
+    return -1;
+  }
+  if ((size_t)sb.st_size > length) {
+    length = sb.st_size;
+  }
+
+  void *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return -1;
+  }
+
+  // Slots are read a page at a time, mapping in their neighbours along with
+  // them would make idle sessions resident again
+  madvise(base, length, MADV_RANDOM);
+
+  st->base = base;
+  st->length = length;
+  st->count = (length - st->page_size) / st->slot_size;
+
+  struct store_header *header = base;
+  if (fresh) {
+    memcpy(header->magic, STORE_MAGIC, sizeof(header->magic));
+    header->version = STORE_VERSION;
+    header->machine_size = sizeof(struct machine);
+    header->slot_size = st->slot_size;
+    header->rom = rom;
+  } else if (memcmp(header->magic, STORE_MAGIC, sizeof(header->magic)) ||
+      header->version != STORE_VERSION ||
+      header->machine_size != sizeof(struct machine) ||
+      header->slot_size != st->slot_size || header->rom != rom) {
+    store_close(st);
+    return -1;
+  }
+  header->count = st->count;
+
+  return 0;
+}
+
+// Unmaps the store, writing everything in it back to disk first
+void store_close(struct store *st) {
+  if (st->base != NULL) {
+    msync(st->base, st->length, MS_SYNC);
+    munmap(st->base, st->length);
+  }
+  memset(st, 0, sizeof(*st));
+}
+
+// Lets go of slot i's pages
+// Anything changed is written back to the file in the background, and pages
+// only come back if something reads them again.
+void store_evict(struct store *st, size_t i) {
+  struct store_slot *slot = store_slot(st, i);
+  msync(slot, st->slot_size, MS_ASYNC);
+  madvise(slot, st->slot_size, MADV_DONTNEED);
+}
+
+// Hibernates a machine into slot i
+void store_save(struct store *st, size_t i, const struct machine *m, int state) {
+  struct store_slot *slot = store_slot(st, i);
+  memcpy(&slot->m, m, machine_bytes(m));
+  slot->state = state;
+  store_evict(st, i);
+}
+
+// Brings the machine in slot i back into m, which must be cleared or have the
+// session's ROM image mapped over it, and empties the slot
+// Memory comes back a page at a time, skipping pages that already match, so
+// pages the session never wrote carry on being shared with the image.
+void store_load(struct store *st, size_t i, struct machine *m) {
+  struct store_slot *slot = store_slot(st, i);
+  size_t top = machine_bytes(&slot->m) - offsetof(struct machine, memory);
+
+  memcpy(m, &slot->m, offsetof(struct machine, memory));
+  for (size_t at = 0; at < top; at += st->page_size) {
+    size_t n = top - at < st->page_size ? top - at : st->page_size;
+    if (memcmp(&m->memory[at], &slot->m.memory[at], n)) {
+      memcpy(&m->memory[at], &slot->m.memory[at], n);
+    }
+  }
+
+  slot->state = STORE_EMPTY;
+  store_evict(st, i);
+}
@@ -0,0 +1,59 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+// Session stores
+// Hibernated sessions live in a file mapped into memory, one fixed-size slot
+// per session. A slot holds the machine exactly as it's laid out in memory,
+// so going in and out is a single copy, and anything that only reads a
+// machine, like streaming its display, can read it straight from the slot.
+#define STORE_MAGIC "DIPSTORE"
+#define STORE_VERSION 1
+
+enum store_state {
+  STORE_EMPTY,
+  STORE_PARKED,  // Hibernated while blocked on a key
+  STORE_RUNNING, // Saved on the way out while it was still running
+};
+
+struct store_header {
+  char magic[8];
+  uint32_t version;
+  // Catches stores written by builds with another MEMORY_SIZE or page size
+  uint32_t machine_size;
+  uint32_t slot_size;
+  uint32_t count;
+  // Hash of the ROM every session is running
+  uint64_t rom;
+};
+
+struct store_slot {
+  uint32_t state;
+  struct machine m;
+};
+
+struct store {
+  uint8_t *base;
+  size_t length;
+  size_t page_size;
+  size_t slot_size;
+  size_t count;
+};
+
+int store_open(struct store *st, const char *path, size_t count, uint64_t rom);
+void store_close(struct store *st);
+
+void store_evict(struct store *st, size_t i);
+void store_save(struct store *st, size_t i, const struct machine *m, int state);
+void store_load(struct store *st, size_t i, struct machine *m);
+
+// Slots follow a page holding the header
+static inline struct store_slot *store_slot(const struct store *st, size_t i) {
+  return (struct store_slot *)(st->base + st->page_size + i * st->slot_size);
+}
+
+#endif // STORE_H
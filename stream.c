@@ -0,0 +1,506 @@
+/*
+
+Frame streaming to remote viewers
+
+Every frame each watched session has its changed rows encoded once into a
+shared message, which is queued on every viewer watching it. Viewers are
+written to with non-blocking sends driven by epoll, so a slow viewer only
+ever costs its own queue, and one that falls too far behind has its backlog
+thrown away and picks up again from a keyframe.
+
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "stream.h"
+
+// Most messages handed to a single send
+#define STREAM_IOV 16
+
+// Marks the listening socket in epoll events, clients use their index
+#define LISTENER UINT64_MAX
+
+// Fills in the address for "[host]:port" over TCP, anything else is the path
+// of a UNIX socket
+// TCP hosts default to the loopback address as streams are only meant to be
+// served locally.
+static socklen_t stream_address(const char *addr, struct sockaddr_storage *ss) {
+  memset(ss, 0, sizeof(*ss));
+
+  const char *colon = strrchr(addr, ':');
+  if (colon != NULL) {
+    struct sockaddr_in *in = (struct sockaddr_in *)ss;
+    char host[64] = "127.0.0.1";
+    if (colon > addr) {
+      if ((size_t)(colon - addr) >= sizeof(host)) {
+        return 0;
+      }
+      memcpy(host, addr, colon - addr);
+      host[colon - addr] = '\0';
+    }
+    in->sin_family = AF_INET;
+    in->sin_port = htons(atoi(colon + 1));
+    if (inet_pton(AF_INET, host, &in->sin_addr) != 1) {
+      return 0;
+    }
+    return sizeof(*in);
+  }
+
+  struct sockaddr_un *un = (struct sockaddr_un *)ss;
+  if (strlen(addr) >= sizeof(un->sun_path)) {
+    return 0;
+  }
+  un->sun_family = AF_UNIX;
+  strcpy(un->sun_path, addr);
+  return sizeof(*un);
+}
+
+static void set_nonblocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// Connects to a stream, for viewers
+// Returns the socket, or -1 if it couldn't connect.
+int stream_connect(const char *addr) {
+  struct sockaddr_storage ss;
+  socklen_t len = stream_address(addr, &ss);
+  if (len == 0) {
+    fprintf(stderr, "Bad stream address: %s\n", addr);
+    return -1;
+  }
+
+  int fd = socket(ss.ss_family, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&ss, len) < 0) {
+    perror(addr);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+
+  return fd;
+}
+
+// Messages
+
+static struct stream_msg *encode_msg(uint8_t type, size_t session,
+    struct capture_frame *last, const struct machine *m, uint64_t frame) {
+  struct stream_msg *msg = malloc(sizeof(*msg) + STREAM_MSG_MAX);
+  if (msg == NULL) {
+    return NULL;
+  }
+
+  size_t n = capture_encode(last, m, frame, msg->data + sizeof(struct stream_header));
+  if (n == 0) {
+    free(msg);
+    return NULL;
+  }
+
+  struct stream_header header = {
+    .type = type,
+    .session = session,
+    .length = n
+  };
+  memcpy(msg->data, &header, sizeof(header));
+  msg->length = sizeof(header) + n;
+  msg->refs = 1;
+
+  return msg;
+}
+
+static void release(struct stream_msg *msg) {
+  if (msg != NULL && --msg->refs == 0) {
+    free(msg);
+  }
+}
+
+// Clients
+
+static void watch_writable(struct stream *st, struct stream_client *cl, int want) {
+  if (cl->want_write == want) {
+    return;
+  }
+
+  struct epoll_event ev = {
+    .events = EPOLLIN | (want ? EPOLLOUT : 0),
+    .data.u64 = cl - st->clients
+  };
+  epoll_ctl(st->epfd, EPOLL_CTL_MOD, cl->fd, &ev);
+  cl->want_write = want;
+}
+
+// Throws away everything queued, bar a message that's partly been sent
+static void drop_queue(struct stream_client *cl, int all) {
+  size_t keep = !all && cl->sent > 0 ? 1 : 0;
+
+  for (size_t i = keep; i < cl->count; i++) {
+    release(cl->queue[(cl->head + i) % STREAM_QUEUE]);
+  }
+  cl->count = keep;
+  if (!keep) {
+    cl->sent = 0;
+  }
+}
+
+static void close_client(struct stream *st, struct stream_client *cl) {
+  epoll_ctl(st->epfd, EPOLL_CTL_DEL, cl->fd, NULL);
+  close(cl->fd);
+  cl->fd = -1;
+
+  drop_queue(cl, 1);
+  if (cl->session >= 0) {
+    st->channels[cl->session].watchers--;
+  }
+
+  st->free_list[st->free_count++] = cl - st->clients;
+}
+
+static void push(struct stream_client *cl, struct stream_msg *msg) {
+  msg->refs++;
+  cl->queue[(cl->head + cl->count) % STREAM_QUEUE] = msg;
+  cl->count++;
+}
+
+// Sends as much of the queue as the socket will take without blocking
+static void flush(struct stream *st, struct stream_client *cl) {
+  while (cl->count > 0) {
+    struct iovec iov[STREAM_IOV];
+    int n = 0;
+    for (size_t i = 0; i < cl->count && n < STREAM_IOV; i++, n++) {
+      struct stream_msg *msg = cl->queue[(cl->head + i) % STREAM_QUEUE];
+      size_t skip = i == 0 ? cl->sent : 0;
+      iov[n].iov_base = msg->data + skip;
+      iov[n].iov_len = msg->length - skip;
+    }
+
+    // A viewer that's gone away shows up as EPIPE rather than a SIGPIPE
+    // taking the whole host down
+    struct msghdr mh = { .msg_iov = iov, .msg_iovlen = n };
+    ssize_t sent = sendmsg(cl->fd, &mh, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        watch_writable(st, cl, 1);
+      } else if (errno != EINTR) {
+        close_client(st, cl);
+      }
+      return;
+    }
+    st->bytes += sent;
+
+    // Pop whatever went out in full
+    size_t left = cl->sent + sent;
+    while (cl->count > 0 && left >= cl->queue[cl->head]->length) {
+      left -= cl->queue[cl->head]->length;
+      release(cl->queue[cl->head]);
+      cl->head = (cl->head + 1) % STREAM_QUEUE;
+      cl->count--;
+      st->messages++;
+    }
+    cl->sent = left;
+  }
+
+  watch_writable(st, cl, 0);
+}
+
+static void accept_clients(struct stream *st) {
+  for (;;) {
+    int fd = accept(st->listen_fd, NULL, NULL);
+    if (fd < 0) {
+      return;
+    }
+
+    if (st->free_count == 0) {
+      close(fd);
+      continue;
+    }
+
+    set_nonblocking(fd);
+
+    int i = st->free_list[--st->free_count];
+    struct stream_client *cl = &st->clients[i];
+    memset(cl, 0, sizeof(*cl));
+    cl->fd = fd;
+    cl->session = -1;
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = i };
+    epoll_ctl(st->epfd, EPOLL_CTL_ADD, fd, &ev);
+  }
+}
+
+// Acts on a single line from a viewer
+static void handle_line(struct stream *st, struct stream_client *cl, char *line,
+    struct stream_key *keys, int max, int *n) {
+  char *end;
+
+  if (!strncmp(line, "watch ", 6)) {
+    unsigned long session = strtoul(line + 6, &end, 10);
+    if (end == line + 6 || session >= st->nchannels || st->channels[session].m == NULL) {
+      return;
+    }
+
+    if (cl->session >= 0) {
+      st->channels[cl->session].watchers--;
+    }
+    cl->session = session;
+    st->channels[session].watchers++;
+
+    // Nothing queued for the old session is any use now
+    drop_queue(cl, 0);
+    cl->need_key = 1;
+    return;
+  }
+
+  if (!strncmp(line, "key ", 4) && cl->session >= 0 && *n < max) {
+    unsigned long key = strtoul(line + 4, &end, 16);
+    if (end == line + 4 || key > 0xF) {
+      return;
+    }
+    keys[*n].session = cl->session;
+    keys[*n].key = key;
+    keys[*n].down = strtoul(end, NULL, 10) != 0;
+    (*n)++;
+  }
+}
+
+static void read_client(struct stream *st, struct stream_client *cl,
+    struct stream_key *keys, int max, int *n) {
+  ssize_t got = read(cl->fd, cl->in + cl->in_length, sizeof(cl->in) - 1 - cl->in_length);
+  if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+    close_client(st, cl);
+    return;
+  }
+  if (got < 0) {
+    return;
+  }
+  cl->in_length += got;
+  cl->in[cl->in_length] = '\0';
+
+  char *line = cl->in;
+  char *nl;
+  while ((nl = strchr(line, '\n')) != NULL) {
+    *nl = '\0';
+    if (nl > line && nl[-1] == '\r') {
+      nl[-1] = '\0';
+    }
+    handle_line(st, cl, line, keys, max, n);
+    line = nl + 1;
+  }
+
+  // Keep any partial line for next time, unless it can never fit
+  cl->in_length -= line - cl->in;
+  memmove(cl->in, line, cl->in_length);
+  if (cl->in_length == sizeof(cl->in) - 1) {
+    cl->in_length = 0;
+  }
+}
+
+// Server
+
+// Starts serving on addr with room for nchannels sessions
+// Nothing is served if addr is empty. Returns -1 if the socket couldn't be
+// set up.
+int stream_open(struct stream *st, const char *addr, size_t nchannels) {
+  memset(st, 0, sizeof(*st));
+  st->epfd = -1;
+  st->listen_fd = -1;
+
+  if (addr == NULL || addr[0] == '\0') {
+    return 0;
+  }
+
+  struct sockaddr_storage ss;
+  socklen_t len = stream_address(addr, &ss);
+  if (len == 0) {
+    fprintf(stderr, "Bad stream address: %s\n", addr);
+    return -1;
+  }
+
+  st->channels = calloc(nchannels, sizeof(*st->channels));
+  st->clients = calloc(STREAM_CLIENTS, sizeof(*st->clients));
+  st->free_list = malloc(STREAM_CLIENTS * sizeof(*st->free_list));
+  if (st->channels == NULL || st->clients == NULL || st->free_list == NULL) {
+    free(st->channels);
+    free(st->clients);
+    free(st->free_list);
+    st->clients = NULL;
+    return -1;
+  }
+  st->nchannels = nchannels;
+
+  for (int i = 0; i < STREAM_CLIENTS; i++) {
+    st->clients[i].fd = -1;
+    st->free_list[i] = STREAM_CLIENTS - 1 - i;
+  }
+  st->free_count = STREAM_CLIENTS;
+
+  st->listen_fd = socket(ss.ss_family, SOCK_STREAM, 0);
+  if (st->listen_fd < 0) {
+    perror("socket");
+    stream_close(st);
+    return -1;
+  }
+
+  int one = 1;
+  setsockopt(st->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  // Clear out any socket left behind by an earlier run
+  if (ss.ss_family == AF_UNIX) {
+    unlink(addr);
+    strcpy(st->path, addr);
+  }
+
+  if (bind(st->listen_fd, (struct sockaddr *)&ss, len) < 0 ||
+      listen(st->listen_fd, 64) < 0) {
+    perror(addr);
+    st->path[0] = '\0';
+    stream_close(st);
+    return -1;
+  }
+  set_nonblocking(st->listen_fd);
+
+  st->epfd = epoll_create1(0);
+  struct epoll_event ev = { .events = EPOLLIN, .data.u64 = LISTENER };
+  if (st->epfd < 0 || epoll_ctl(st->epfd, EPOLL_CTL_ADD, st->listen_fd, &ev) < 0) {
+    perror("epoll");
+    stream_close(st);
+    return -1;
+  }
+
+  return 0;
+}
+
+void stream_close(struct stream *st) {
+  for (int i = 0; st->clients != NULL && i < STREAM_CLIENTS; i++) {
+    if (st->clients[i].fd >= 0) {
+      close_client(st, &st->clients[i]);
+    }
+  }
+
+  if (st->listen_fd >= 0) {
+    close(st->listen_fd);
+    if (st->path[0] != '\0') {
+      unlink(st->path);
+    }
+  }
+  if (st->epfd >= 0) {
+    close(st->epfd);
+  }
+
+  free(st->channels);
+  free(st->clients);
+  free(st->free_list);
+  memset(st, 0, sizeof(*st));
+  st->epfd = -1;
+  st->listen_fd = -1;
+}
+
+// Makes a session available to watch
+void stream_attach(struct stream *st, size_t session, struct machine *m) {
+  if (session < st->nchannels) {
+    st->channels[session].m = m;
+  }
+}
+
+// Sends the frame just run to everyone watching
+// Must be called between frames, while the machines aren't running.
+void stream_frame(struct stream *st, uint64_t frame) {
+  if (st->listen_fd < 0) {
+    return;
+  }
+
+  // Encode each watched session that drew anything once, for every watcher
+  for (size_t i = 0; i < st->nchannels; i++) {
+    struct stream_channel *ch = &st->channels[i];
+    if (ch->watchers > 0 && ch->m->draws != ch->draws) {
+      ch->draws = ch->m->draws;
+      ch->delta = encode_msg(STREAM_DELTA, i, &ch->last, ch->m, frame);
+    }
+  }
+
+  for (int i = 0; i < STREAM_CLIENTS; i++) {
+    struct stream_client *cl = &st->clients[i];
+    if (cl->fd < 0 || cl->session < 0) {
+      continue;
+    }
+
+    struct stream_channel *ch = &st->channels[cl->session];
+
+    // Too far behind to catch up delta by delta
+    if (cl->count >= STREAM_QUEUE) {
+      drop_queue(cl, 0);
+      cl->need_key = 1;
+    }
+
+    if (cl->need_key) {
+      if (ch->key == NULL) {
+        // Against a blank frame that never matches, so every row is written
+        struct capture_frame blank = { .hires = 0xFF };
+        ch->key = encode_msg(STREAM_KEYFRAME, cl->session, &blank, ch->m, frame);
+      }
+      if (ch->key != NULL) {
+        push(cl, ch->key);
+        cl->need_key = 0;
+      }
+    } else if (ch->delta != NULL) {
+      push(cl, ch->delta);
+    }
+
+    flush(st, cl);
+  }
+
+  for (size_t i = 0; i < st->nchannels; i++) {
+    struct stream_channel *ch = &st->channels[i];
+    release(ch->delta);
+    release(ch->key);
+    ch->delta = NULL;
+    ch->key = NULL;
+  }
+}
+
+// Accepts viewers, reads their commands and sends anything pending, without
+// blocking
+// Keys pressed by viewers are written to keys, any past max are dropped.
+// Returns how many there were.
+int stream_poll(struct stream *st, struct stream_key *keys, int max) {
+  if (st->epfd < 0) {
+    return 0;
+  }
+
+  struct epoll_event events[64];
+  int n = 0;
+  int ready = epoll_wait(st->epfd, events, 64, 0);
+
+  for (int i = 0; i < ready; i++) {
+    if (events[i].data.u64 == LISTENER) {
+      accept_clients(st);
+      continue;
+    }
+
+    struct stream_client *cl = &st->clients[events[i].data.u64];
+    if (cl->fd >= 0 && (events[i].events & (EPOLLHUP | EPOLLERR))) {
+      close_client(st, cl);
+      continue;
+    }
+    if (cl->fd >= 0 && (events[i].events & EPOLLOUT)) {
+      flush(st, cl);
+    }
+    if (cl->fd >= 0 && (events[i].events & EPOLLIN)) {
+      read_client(st, cl, keys, max, &n);
+    }
+  }
+
+  return n;
+}
@@ -0,0 +1,108 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "capture.h"
+#include "cpu.h"
+
+// Frame streaming
+// Viewers connect over a local TCP or UNIX socket and send text lines:
+//
+//   watch [session]     start receiving a session's display
+//   key [0-F] [0|1]     press or release a key on the watched session
+//
+// Displays are sent back as messages, a stream_header then a capture record
+// (see capture.h). Keyframes hold the whole display, deltas the rows changed
+// since the last message. The record's frame count is the host's frame
+// number.
+#define STREAM_KEYFRAME 'K'
+#define STREAM_DELTA 'D'
+
+// Most viewers at once, and most messages queued for a viewer before it's
+// treated as too slow, dropped back to a keyframe
+#define STREAM_CLIENTS 1024
+#define STREAM_QUEUE 64
+
+struct stream_header {
+  uint8_t type;
+  uint8_t reserved;
+  uint16_t session;
+  uint32_t length;
+};
+
+// Largest a message can get, header and record, what both ends size their
+// buffers from
+#define STREAM_MSG_MAX (sizeof(struct stream_header) + CAPTURE_RECORD_MAX)
+
+// An encoded message, shared by every viewer it's sent to
+struct stream_msg {
+  int refs;
+  size_t length;
+  uint8_t data[];
+};
+
+// A session that can be watched
+struct stream_channel {
+  struct machine *m;
+  struct capture_frame last;
+  uint32_t draws;
+  int watchers;
+
+  // Messages encoded this frame, NULL if there wasn't a need for one
+  struct stream_msg *delta;
+  struct stream_msg *key;
+};
+
+struct stream_client {
+  int fd;
+  int want_write;
+  // Channel being watched, -1 for none
+  long session;
+  int need_key;
+
+  // Messages waiting to go out, and how much of the first has been sent
+  struct stream_msg *queue[STREAM_QUEUE];
+  size_t head;
+  size_t count;
+  size_t sent;
+
+  char in[256];
+  size_t in_length;
+};
+
+// Key pressed or released by a viewer
+struct stream_key {
+  size_t session;
+  uint8_t key;
+  uint8_t down;
+};
+
+struct stream {
+  int epfd;
+  int listen_fd;
+  char path[108];
+
+  struct stream_channel *channels;
+  size_t nchannels;
+
+  struct stream_client *clients;
+  int *free_list;
+  int free_count;
+
+  // Bytes and messages sent so far
+  uint64_t bytes;
+  uint64_t messages;
+};
+
+int stream_open(struct stream *st, const char *addr, size_t nchannels);
+void stream_close(struct stream *st);
+void stream_attach(struct stream *st, size_t session, struct machine *m);
+
+void stream_frame(struct stream *st, uint64_t frame);
+int stream_poll(struct stream *st, struct stream_key *keys, int max);
+
+int stream_connect(const char *addr);
+
+#endif // STREAM_H
@@ -0,0 +1,218 @@
+//
+// Terminal viewer for sessions streamed by dip-host
+//
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "palette.h"
+#include "stream.h"
+
+// Same layout as the SDL frontend, index is the CHIP-8 key
+static const char key_map[] = "x123qweasdzc4rfv";
+
+// Terminals only see key presses, so keys are let go of after this long
+#define KEY_HOLD_MS 100
+
+static struct termios saved_termios;
+
+// Usage instructions for the viewer
+int print_usage() {
+  printf(
+"Usage: dip-view -S [address] [-n session]\n\n"
+"  -S [address]           Stream to watch, [host]:port or a UNIX socket path\n"
+"  -n [session]           Session to watch (default 0)\n\n"
+"  Keys map as in dip, Escape quits\n");
+
+  exit(EXIT_SUCCESS);
+}
+
+static void restore_terminal() {
+  tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_termios);
+  // Show the cursor again and reset colours
+  printf("\x1b[0m\x1b[?25h\n");
+}
+
+static void raw_terminal() {
+  tcgetattr(STDIN_FILENO, &saved_termios);
+  atexit(restore_terminal);
+
+  struct termios t = saved_termios;
+  t.c_lflag &= ~(ECHO | ICANON);
+  t.c_cc[VMIN] = 0;
+  t.c_cc[VTIME] = 0;
+  tcsetattr(STDIN_FILENO, TCSAFLUSH, &t);
+
+  // Clear the screen and hide the cursor
+  printf("\x1b[2J\x1b[?25l");
+}
+
+// Draws the frame two pixel rows to a line with half blocks
+static void draw(const struct capture_frame *f) {
+  static char out[GFX_HI_HEIGHT / 2 * (GFX_HI_WIDTH * 40 + 8) + 16];
+  size_t n = sprintf(out, "\x1b[H");
+
+  for (int y = 0; y < GFX_HI_HEIGHT; y += 2) {
+    int fg = -1, bg = -1;
+    for (int x = 0; x < GFX_HI_WIDTH; x++) {
+      int top = capture_pixel(f, x, y);
+      int bottom = capture_pixel(f, x, y + 1);
+      if (top != fg) {
+        n += sprintf(out + n, "\x1b[38;2;%d;%d;%dm",
+            palette_red(top), palette_green(top), palette_blue(top));
+        fg = top;
+      }
+      if (bottom != bg) {
+        n += sprintf(out + n, "\x1b[48;2;%d;%d;%dm",
+            palette_red(bottom), palette_green(bottom), palette_blue(bottom));
+        bg = bottom;
+      }
+      n += sprintf(out + n, "▀");
+    }
+    n += sprintf(out + n, "\x1b[0m\n");
+  }
+
+  fwrite(out, 1, n, stdout);
+  fflush(stdout);
+}
+
+static uint64_t now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void send_key(int fd, int key, int down) {
+  char line[16];
+  int n = snprintf(line, sizeof(line), "key %X %d\n", key, down);
+  if (write(fd, line, n) != n) {
+    exit(EXIT_FAILURE);
+  }
+}
+
+int main(int argc, char **argv) {
+
+  char *addr = NULL;
+  long session = 0;
+
+  // Parse arguments
+  for (int i = 1; i < argc; i++) {
+    if (i == argc-1) {
+      print_usage();
+    } else if (!strcmp(argv[i], "-S")) {
+      addr = argv[++i];
+    } else if (!strcmp(argv[i], "-n")) {
+      session = atol(argv[++i]);
+    } else {
+      print_usage();
+    }
+  }
+
+  if (addr == NULL) {
+    print_usage();
+  }
+
+  int fd = stream_connect(addr);
+  if (fd < 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  char watch[32];
+  int len = snprintf(watch, sizeof(watch), "watch %ld\n", session);
+  if (write(fd, watch, len) != len) {
+    exit(EXIT_FAILURE);
+  }
+
+  raw_terminal();
+
+  struct capture_frame frame = { 0 };
+  // Room for a few whole messages, they're consumed as soon as they're in
+  static uint8_t buf[8 * STREAM_MSG_MAX];
+  size_t have = 0;
+  // When to let go of each key, 0 if it isn't down
+  uint64_t held[16] = { 0 };
+
+  for (;;) {
+    struct pollfd fds[2] = {
+      { .fd = fd, .events = POLLIN },
+      { .fd = STDIN_FILENO, .events = POLLIN },
+    };
+    poll(fds, 2, KEY_HOLD_MS / 4);
+
+    if (fds[0].revents & (POLLIN | POLLHUP)) {
+      ssize_t got = read(fd, buf + have, sizeof(buf) - have);
+      if (got <= 0) {
+        break;
+      }
+      have += got;
+
+      // Apply every whole message, only the last is worth drawing
+      size_t pos = 0;
+      int dirty = 0;
+      struct stream_header header;
+      while (have - pos >= sizeof(header)) {
+        memcpy(&header, buf + pos, sizeof(header));
+        if (sizeof(header) + header.length > STREAM_MSG_MAX) {
+          fprintf(stderr, "Bad message from stream\n");
+          exit(EXIT_FAILURE);
+        }
+        if (have - pos < sizeof(header) + header.length) {
+          break;
+        }
+
+        if (header.type == STREAM_KEYFRAME) {
+          memset(&frame, 0, sizeof(frame));
+        }
+        uint64_t number;
+        if (capture_decode(&frame, buf + pos + sizeof(header), header.length, &number) < 0) {
+          fprintf(stderr, "Bad message from stream\n");
+          exit(EXIT_FAILURE);
+        }
+        pos += sizeof(header) + header.length;
+        dirty = 1;
+      }
+      have -= pos;
+      memmove(buf, buf + pos, have);
+
+      if (dirty) {
+        draw(&frame);
+      }
+    }
+
+    if (fds[1].revents & POLLIN) {
+      char c;
+      while (read(STDIN_FILENO, &c, 1) == 1) {
+        if (c == 27) {
+          exit(EXIT_SUCCESS);
+        }
+        const char *k = memchr(key_map, c, 16);
+        if (k != NULL) {
+          if (!held[k - key_map]) {
+            send_key(fd, k - key_map, 1);
+          }
+          held[k - key_map] = now_ms() + KEY_HOLD_MS;
+        }
+      }
+    }
+
+    uint64_t now = now_ms();
+    for (int i = 0; i < 16; i++) {
+      if (held[i] && now >= held[i]) {
+        send_key(fd, i, 0);
+        held[i] = 0;
+      }
+    }
+  }
+
+  fprintf(stderr, "Stream closed\n");
+
+  return 0;
+}
@@ -0,0 +1,276 @@
+//
+// Wall of many sessions tiled into a single window
+//
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include <SDL2/SDL.h>
+
+#include "cpu.h"
+#include "image.h"
+#include "keypad.h"
+#include "palette.h"
+#include "pool.h"
+#include "rom.h"
+#include "sched.h"
+#include "stats.h"
+
+// Every tile is the size of a hi-res display, lo-res ones are doubled up
+#define TILE_WIDTH GFX_HI_WIDTH
+#define TILE_HEIGHT GFX_HI_HEIGHT
+
+// Largest the window is allowed to get
+#define WALL_MAX_WIDTH 1600
+#define WALL_MAX_HEIGHT 900
+
+// Usage instructions for the wall
+int print_usage() {
+  printf(
+"Usage: dip-wall -r [path_to_rom] [options]\n\n"
+"  -r [path_to_rom]       Load from from path\n"
+"  -p [path_to_pack]      Load the ROM by name from a ROM pack\n"
+"  -n [sessions]          Number of sessions to tile (default 16)\n"
+"  -t [threads]           Number of worker threads (default 1)\n"
+"  -c [cycles]            Instruction budget per session per frame (default 10)\n"
+"  -w [columns]           Tiles per row (default as square as possible)\n"
+"  -k [bindings]          Bind keypad keys as [0-F]=[key], or [0-F]=pad:[button]\n"
+"                         for gamepads, separated by commas\n"
+"  -m [path]              Write metrics as JSON lines every second, - for stderr\n\n"
+"  Click a tile to send it the keyboard and gamepads\n");
+
+  exit(EXIT_SUCCESS);
+}
+
+// Draws a machine's display as a tile of ARGB pixels
+static void draw_tile(const struct machine *m, uint32_t *pixels) {
+  int shift = m->hires ? 0 : 1;
+
+  for (int y = 0; y < TILE_HEIGHT; y++) {
+    const uint64_t *p0 = m->gfx[0][y >> shift];
+    const uint64_t *p1 = m->gfx[1][y >> shift];
+    for (int x = 0; x < TILE_WIDTH; x++) {
+      int sx = x >> shift;
+      int bit = 63 - (sx & 63);
+      int colour = ((p0[sx >> 6] >> bit) & 1) | (((p1[sx >> 6] >> bit) & 1) << 1);
+      *pixels++ = palette[colour];
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+
+  char rom_path[256] = "";
+  char pack_path[256] = "";
+  char stats_path[256] = "";
+  size_t sessions = 16;
+  int threads = 1;
+  uint32_t cycles = 10;
+  int columns = 0;
+
+  keypad_init();
+
+  // Parse arguments
+  for (int i = 1; i < argc; i++) {
+    if (i == argc-1) {
+      print_usage();
+    } else if (!strcmp(argv[i], "-r")) {
+      strncpy(rom_path, argv[++i], sizeof(rom_path) - 1);
+    } else if (!strcmp(argv[i], "-p")) {
+      strncpy(pack_path, argv[++i], sizeof(pack_path) - 1);
+    } else if (!strcmp(argv[i], "-m")) {
+      strncpy(stats_path, argv[++i], sizeof(stats_path) - 1);
+    } else if (!strcmp(argv[i], "-n")) {
+      sessions = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-t")) {
+      threads = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-c")) {
+      cycles = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-w")) {
+      columns = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-k")) {
+      if (keypad_bind(argv[++i]) < 0) {
+        fprintf(stderr, "Can't bind keys: %s\n", argv[i]);
+        print_usage();
+      }
+    } else {
+      print_usage();
+    }
+  }
+
+  if (rom_path[0] == '\0' || sessions == 0) {
+    print_usage();
+  }
+
+  if (columns <= 0) {
+    columns = ceil(sqrt(sessions));
+  }
+  int rows = (sessions + columns - 1) / columns;
+
+  struct rompack pack = { 0 };
+  uint8_t buffer[ROM_MAX];
+  size_t rom_size;
+  const uint8_t *rom = find_rom(&pack, pack_path, rom_path, buffer, &rom_size);
+  if (rom == NULL) {
+    exit(2);
+  }
+
+  struct machine_pool *pool = pool_create(sessions);
+  struct sched *s = sched_create(threads, sessions);
+  struct machine **machines = malloc(sessions * sizeof(*machines));
+  struct session **handles = malloc(sessions * sizeof(*handles));
+  if (pool == NULL || s == NULL || machines == NULL || handles == NULL) {
+    fprintf(stderr, "Couldn't allocate %zu sessions\n", sessions);
+    exit(EXIT_FAILURE);
+  }
+
+  // Every tile shares one image of the ROM, or copies it if there isn't one
+  struct rom_image image;
+  image_create(&image, rom, rom_size);
+  for (size_t i = 0; i < sessions; i++) {
+    machines[i] = pool_acquire(pool);
+    if (image_map(&image, machines[i]) < 0) {
+      initialize(machines[i], rom, rom_size);
+    }
+    handles[i] = sched_add(s, machines[i], cycles);
+  }
+  rompack_close(&pack);
+
+  struct stats stats = { 0 };
+  struct stats_reporter reporter;
+  if (stats_reporter_open(&reporter, stats_path, 1000000) < 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  SDL_Init(SDL_INIT_VIDEO | SDL_INIT_GAMECONTROLLER);
+
+  // Shrink the tiles to fit, or grow them to fill the window
+  int atlas_width = columns * TILE_WIDTH;
+  int atlas_height = rows * TILE_HEIGHT;
+  double zoom = fmin((double)WALL_MAX_WIDTH / atlas_width, (double)WALL_MAX_HEIGHT / atlas_height);
+  if (zoom > 4) {
+    zoom = 4;
+  }
+  int width = atlas_width * zoom;
+  int height = atlas_height * zoom;
+
+  SDL_Window *window = SDL_CreateWindow("Dip wall 🕹", SDL_WINDOWPOS_UNDEFINED,
+      SDL_WINDOWPOS_UNDEFINED, width, height, SDL_WINDOW_SHOWN);
+  SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC);
+
+  // Every tile lives in one texture so the whole wall is a single copy
+  SDL_Texture *atlas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+      SDL_TEXTUREACCESS_STREAMING, atlas_width, atlas_height);
+  if (window == NULL || renderer == NULL || atlas == NULL) {
+    fprintf(stderr, "Couldn't set up the wall: %s\n", SDL_GetError());
+    exit(EXIT_FAILURE);
+  }
+
+  static uint32_t tile[TILE_WIDTH * TILE_HEIGHT];
+  long focus = -1;
+  uint64_t instructions = 0;
+
+  // Vsync paces most displays, this holds faster ones back to 60Hz
+  double deadline = SDL_GetTicks();
+
+  for (;;) {
+    SDL_Event e;
+    int quit = 0;
+
+    // Drain every event, keys go to the focused session
+    while (SDL_PollEvent(&e)) {
+      if (e.type == SDL_QUIT) {
+        quit = 1;
+      } else if (e.type == SDL_MOUSEBUTTONDOWN) {
+        int col = e.button.x * columns / width;
+        int row = e.button.y * rows / height;
+        size_t i = row * columns + col;
+        focus = i < sessions ? (long)i : -1;
+      } else {
+        int down;
+        int k = keypad_event(&e, &down);
+        if (k >= 0 && focus >= 0) {
+          sched_key(s, handles[focus], k, down);
+          stats_add(&stats.input_events, 1);
+        }
+      }
+    }
+    if (quit) {
+      break;
+    }
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    sched_frame(s);
+
+    // Only tiles that drew anything this frame are uploaded again
+    for (size_t i = 0; i < sessions; i++) {
+      struct machine *m = machines[i];
+      if (!m->drawFlag) {
+        continue;
+      }
+      m->drawFlag = 0;
+
+      SDL_Rect rect = {
+        .x = (i % columns) * TILE_WIDTH,
+        .y = (i / columns) * TILE_HEIGHT,
+        .w = TILE_WIDTH,
+        .h = TILE_HEIGHT
+      };
+      draw_tile(m, tile);
+      SDL_UpdateTexture(atlas, &rect, tile, TILE_WIDTH * sizeof(*tile));
+    }
+
+    uint64_t present = SDL_GetPerformanceCounter();
+    SDL_RenderCopy(renderer, atlas, NULL, NULL);
+
+    if (focus >= 0) {
+      SDL_Rect outline = {
+        .x = (focus % columns) * width / columns,
+        .y = (focus / columns) * height / rows,
+        .w = width / columns,
+        .h = height / rows
+      };
+      SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+      SDL_RenderDrawRect(renderer, &outline);
+    }
+
+    SDL_RenderPresent(renderer);
+    uint64_t end = SDL_GetPerformanceCounter();
+
+    uint64_t total = sched_instructions(s);
+    double us = 1e6 / SDL_GetPerformanceFrequency();
+    stats_add(&stats.instructions, total - instructions);
+    stats_add(&stats.frames, 1);
+    stats_add(&stats.presents, 1);
+    stats_set(&stats.cycles_per_frame, total - instructions);
+    stats_record(&stats.frame_us, (present - start) * us);
+    stats_record(&stats.present_us, (end - present) * us);
+    stats_report(&reporter, &stats, end * us);
+    instructions = total;
+
+    deadline += 1000.0 / 60;
+    uint32_t now = SDL_GetTicks();
+    if (now < deadline) {
+      SDL_Delay(deadline - now);
+    } else if (now > deadline + 100) {
+      // Fell well behind, don't try to make it all up
+      deadline = now;
+    }
+  }
+
+  stats_reporter_close(&reporter);
+  sched_destroy(s);
+  pool_destroy(pool);
+  image_close(&image);
+  free(machines);
+  free(handles);
+
+  SDL_DestroyTexture(atlas);
+  SDL_DestroyRenderer(renderer);
+  SDL_DestroyWindow(window);
+  SDL_Quit();
+
+  return 0;
+}